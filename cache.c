@@ -0,0 +1,144 @@
+#include "cache.h"
+#include "lexer.h"
+#include "utils.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#define make_dir(path) _mkdir(path)
+#define process_id() _getpid()
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#define make_dir(path) mkdir(path, 0755)
+#define process_id() getpid()
+#endif
+
+#define CACHE_PATH_SIZE 4096
+
+/* A cache entry is this magic, the source length as a native u64, the
+ * source itself and then the pre-tokenized image */
+#define CACHE_MAGIC "CFC\x1a"
+#define CACHE_HEADER_SIZE (4 + sizeof(uint64_t))
+
+static bool ensure_dir(const char *path) {
+  return make_dir(path) == 0 || errno == EEXIST;
+}
+
+/* Build the cache file path for this source, creating directories */
+static bool cache_path(char *path, const char *build, const void *src,
+                       size_t size) {
+  const char *base = getenv("XDG_CACHE_HOME");
+  int len;
+  if (base && *base) {
+    len = snprintf(path, CACHE_PATH_SIZE, "%s", base);
+  } else {
+#ifdef _WIN32
+    base = getenv("LOCALAPPDATA");
+#else
+    base = getenv("HOME");
+#endif
+    if (!base || !*base)
+      return false;
+#ifdef _WIN32
+    len = snprintf(path, CACHE_PATH_SIZE, "%s", base);
+#else
+    len = snprintf(path, CACHE_PATH_SIZE, "%s/.cache", base);
+#endif
+  }
+  if (len < 0 || len >= CACHE_PATH_SIZE - 64 || !ensure_dir(path))
+    return false;
+
+  len += snprintf(path + len, CACHE_PATH_SIZE - len, "/cfbasic");
+  if (!ensure_dir(path))
+    return false;
+
+  /* The build string, token numbering and image format are hashed in, so
+   * a new interpreter never sees images written by an old one even when
+   * only some of its objects were rebuilt */
+  uint32_t formats[2] = {lexer_code_version(), BINARY_VERSION};
+  uint64_t hash = hash_fnv1a(build, strlen(build) + 1, FNV_OFFSET_BASIS);
+  hash = hash_fnv1a(formats, sizeof(formats), hash);
+  hash = hash_fnv1a(src, size, hash);
+  snprintf(path + len, CACHE_PATH_SIZE - len, "/%016llx.cfb",
+           (unsigned long long)hash);
+  return true;
+}
+
+/* Write via a temporary file and rename, so a concurrent run never maps a
+ * half-written image. Failures are silent: the cache is best effort. */
+static void cache_store(Interpreter *interp, const char *path,
+                        const void *src, size_t size) {
+  char tmp[CACHE_PATH_SIZE + 32];
+  snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", path, (long)process_id());
+
+  FILE *file = fopen(tmp, "wb");
+  if (!file)
+    return;
+  uint64_t length = size;
+  bool ok = fwrite(CACHE_MAGIC, 1, 4, file) == 4 &&
+            fwrite(&length, sizeof(length), 1, file) == 1 &&
+            fwrite(src, 1, size, file) == size &&
+            interpreter_write_binary(interp, file);
+  if (fclose(file) != 0 || !ok || rename(tmp, path) != 0)
+    remove(tmp);
+}
+
+/* The entry was written for exactly this source, not just one that hashes
+ * the same */
+static bool cache_entry_matches(const uint8_t *entry, size_t entry_size,
+                                const void *src, size_t size) {
+  uint64_t length;
+  if (entry_size < CACHE_HEADER_SIZE ||
+      memcmp(entry, CACHE_MAGIC, 4) != 0)
+    return false;
+  memcpy(&length, entry + 4, sizeof(length));
+  return length == size && entry_size - CACHE_HEADER_SIZE >= size &&
+         memcmp(entry + CACHE_HEADER_SIZE, src, size) == 0;
+}
+
+static void clear_error(Interpreter *interp) {
+  interp->error_occurred = false;
+  safe_free(interp->error_message);
+  interp->error_message = NULL;
+}
+
+bool cache_load(Interpreter *interp, const char *filename, const char *build) {
+  size_t size;
+  const void *src = file_map(filename, &size);
+  if (!src)
+    return interpreter_load(interp, filename);
+
+  char path[CACHE_PATH_SIZE];
+  bool cacheable =
+      !interpreter_is_binary(src, size) && cache_path(path, build, src, size);
+
+  if (cacheable) {
+    size_t entry_size;
+    const uint8_t *entry = file_map(path, &entry_size);
+    if (entry) {
+      bool ok = cache_entry_matches(entry, entry_size, src, size);
+      const uint8_t *image = entry + CACHE_HEADER_SIZE + size;
+      size_t image_size = ok ? entry_size - CACHE_HEADER_SIZE - size : 0;
+      ok = ok && interpreter_is_binary(image, image_size) &&
+           interpreter_load_image(interp, image, image_size);
+      file_unmap(entry, entry_size);
+      if (ok) {
+        file_unmap(src, size);
+        return true;
+      }
+      /* Damaged or from another token set: rebuild it */
+      clear_error(interp);
+    }
+  }
+
+  bool ok = interpreter_load_image(interp, src, size);
+  if (ok && cacheable)
+    cache_store(interp, path, src, size);
+  file_unmap(src, size);
+  return ok;
+}
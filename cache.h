@@ -0,0 +1,14 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "interpreter.h"
+
+/* Load a program, reusing the pre-tokenized image cached for identical
+ * source under $XDG_CACHE_HOME/cfbasic (or ~/.cache/cfbasic). On a miss
+ * the source is parsed as usual and its image written for next time.
+ * Entries are keyed by `build`, the token numbering and the image format,
+ * and hold a copy of the source, which must match byte for byte before
+ * the image is used. Behaves like interpreter_load otherwise. */
+bool cache_load(Interpreter *interp, const char *filename, const char *build);
+
+#endif /* CACHE_H */
@@ -1,13 +1,29 @@
+#include "cache.h"
 #include "editor.h"
 #include "interpreter.h"
 #include "lexer.h"
+#include "matrix.h"
+#include "memmap.h"
+#include "snapshot.h"
 #include "utils.h"
 #include <ctype.h>
+#include <errno.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef _WIN32
+#ifndef STDIN_FILENO
+#define STDIN_FILENO 0
+#endif
+#ifndef STDOUT_FILENO
+#define STDOUT_FILENO 1
+#endif
+#else
+#include <unistd.h>
+#endif
+
 static Interpreter *global_interp = NULL;
 
 void handle_sigint(int sig) {
@@ -72,6 +88,10 @@ void print_usage(void) {
   printf("Usage: cfbasic [OPTIONS] [filename]\n");
   printf("Options:\n");
   printf("  -M, --MEM <size>    Set memory limit (e.g., 1G, 512M, 2048K)\n");
+  printf("  -c, --compile <out> Save filename pre-tokenized to out and exit\n");
+  printf("  -r, --ram <image>   Map a 64KB RAM image file; POKEs write to it\n");
+  printf("  --restore <file>    Resume from a SNAPSHOT file\n");
+  printf("  --seed <n>          Seed RND, for a reproducible run\n");
   printf("  -h, --help          Show this help message\n");
   printf("  -v, --version       Show version information\n");
 }
@@ -83,9 +103,12 @@ void print_help(Interpreter *interp) {
       " PRINT, INPUT, LET, GOTO, GOSUB, RETURN\n"
       " IF...THEN...ELSE, FOR...NEXT, DO...LOOP\n"
       " WHILE...WEND, REPEAT...UNTIL, REM, POKE\n"
-      " GRAPHICS: PLOT, DRAW\n"
-      " FUNCTIONS: PEEK, ABS, INT, RND, SIN, COS, TAN, SQR\n"
-      "            LEN, LEFT$, RIGHT$, MID$, STR$, VAL, CHR$, ASC\n";
+      " DATA, READ, RESTORE, SNAPSHOT, DIM, MAT, SORT, DELETE\n"
+      " OPEN, CLOSE, PRINT#, INPUT#, GET#, BLOAD, BSAVE\n"
+      " GRAPHICS: PLOT, DRAW, BOX, CIRCLE, PAINT\n"
+      " FUNCTIONS: PEEK, SEARCH, ABS, INT, RND, SIN, COS, TAN, SQR\n"
+      "            LEN, LEFT$, RIGHT$, MID$, STR$, VAL, CHR$, ASC\n"
+      "            EXISTS, KEY$\n";
   if (interp->editor) {
     editor_print(interp->editor, help_text);
   } else {
@@ -200,7 +223,26 @@ void execute_immediate_command(Interpreter *interp, const char *line) {
     token = lexer_next_token(&lexer);
 
     if (token.type == TOK_STRING) {
-      interpreter_save(interp, token.text);
+      /* SAVE "NAME",B writes the pre-tokenized binary form */
+      bool binary = false;
+      Token option = lexer_next_token(&lexer);
+      if (option.type == TOK_COMMA) {
+        token_free(&option);
+        option = lexer_next_token(&lexer);
+        binary = option.type == TOK_IDENTIFIER &&
+                 str_compare_nocase(option.text, "B") == 0;
+        if (!binary) {
+          interp->error_occurred = true;
+          interp->error_message = str_duplicate("SYNTAX");
+        }
+      }
+      token_free(&option);
+      if (!interp->error_occurred) {
+        if (binary)
+          interpreter_save_binary(interp, token.text);
+        else
+          interpreter_save(interp, token.text);
+      }
     } else {
       interp->error_occurred = true;
       interp->error_message = str_duplicate("FILENAME REQUIRED");
@@ -225,9 +267,11 @@ void execute_immediate_command(Interpreter *interp, const char *line) {
     break;
 
   case TOK_CLR:
+    gfx_clear(&interp->bitmap);
+    mem_discard_screen(interp);
     if (interp->editor) {
       editor_clear(interp->editor);
-    } else {
+    } else if (!interp->headless) {
       clear_screen();
     }
     token_free(&token);
@@ -243,7 +287,49 @@ void execute_immediate_command(Interpreter *interp, const char *line) {
   lexer_free(&lexer);
 }
 
+/* Line-oriented REPL used when stdin or stdout is not a terminal, e.g.
+ * `echo 'PRINT 1' | ./basic`. No raw mode, no screen editor, no banner. */
+static void repl_stream(Interpreter *interp) {
+  while (!interp->exit_requested) {
+    /* Copied out of the shared stdin buffer: a RUN on this line may INPUT
+     * from the same stream */
+    char *line = str_duplicate(chan_line(chan_stdin()));
+    if (!line)
+      break;
+
+    if (strlen(line) > 0) {
+      char *rest;
+      int line_num = extract_line_number(line, &rest);
+
+      if (line_num >= 0) {
+        program_add_line(interp, line_num, rest);
+      } else {
+        execute_immediate_command(interp, line);
+
+        if (interp->error_occurred) {
+          if (interp->error_message) {
+            printf("?%s ERROR\n", interp->error_message);
+            safe_free(interp->error_message);
+            interp->error_message = NULL;
+          } else {
+            printf("?ERROR\n");
+          }
+          interp->error_occurred = false;
+        }
+      }
+    }
+
+    safe_free(line);
+  }
+  fflush(stdout);
+}
+
 void repl(Interpreter *interp) {
+  if (!is_terminal(STDIN_FILENO) || interp->headless) {
+    repl_stream(interp);
+    return;
+  }
+
   Editor ed;
   editor_init(&ed);
   interp->editor = &ed;
@@ -276,6 +362,7 @@ void repl(Interpreter *interp) {
       } else {
         /* Execute immediate command */
         execute_immediate_command(interp, line);
+        mem_sync_screen(interp);
 
         if (interp->error_occurred) {
           char err_buf[256];
@@ -312,6 +399,10 @@ void repl(Interpreter *interp) {
 int main(int argc, char *argv[]) {
   size_t memory_limit = 65536; /* 64KB default */
   const char *filename = NULL;
+  const char *compile_to = NULL;
+  const char *ram_image = NULL;
+  const char *restore_from = NULL;
+  const char *seed = NULL;
 
   /* Parse command line arguments */
   for (int i = 1; i < argc; i++) {
@@ -327,12 +418,46 @@ int main(int argc, char *argv[]) {
         print_usage();
         return 1;
       }
+    } else if (strcmp(argv[i], "-c") == 0 ||
+               strcmp(argv[i], "--compile") == 0) {
+      if (i + 1 < argc) {
+        compile_to = argv[++i];
+      } else {
+        fprintf(stderr, "Missing output file argument\n");
+        print_usage();
+        return 1;
+      }
+    } else if (strcmp(argv[i], "-r") == 0 || strcmp(argv[i], "--ram") == 0) {
+      if (i + 1 < argc) {
+        ram_image = argv[++i];
+      } else {
+        fprintf(stderr, "Missing RAM image argument\n");
+        print_usage();
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--restore") == 0) {
+      if (i + 1 < argc) {
+        restore_from = argv[++i];
+      } else {
+        fprintf(stderr, "Missing snapshot argument\n");
+        print_usage();
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--seed") == 0) {
+      if (i + 1 < argc) {
+        seed = argv[++i];
+      } else {
+        fprintf(stderr, "Missing seed argument\n");
+        print_usage();
+        return 1;
+      }
     } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
       print_usage();
       return 0;
     } else if (strcmp(argv[i], "-v") == 0 ||
                strcmp(argv[i], "--version") == 0) {
       printf("CFBASIC V%s\n", VERSION);
+      printf("MAT kernels: %s\n", mat_kernel_name());
       return 0;
     } else if (argv[i][0] != '-') {
       filename = argv[i];
@@ -349,11 +474,76 @@ int main(int argc, char *argv[]) {
   /* Initialize interpreter */
   Interpreter interp;
   interpreter_init(&interp);
+  if (seed) {
+    char *end;
+    errno = 0;
+    unsigned long long n = strtoull(seed, &end, 0);
+    if (!*seed || *end || errno) {
+      fprintf(stderr, "Invalid seed: %s\n", seed);
+      interpreter_free(&interp);
+      return 1;
+    }
+    rng_seed(&interp.rng, (uint64_t)n);
+  }
+  if (ram_image && !mem_map_image(&interp, ram_image)) {
+    fprintf(stderr, "Cannot map RAM image: %s\n", ram_image);
+    interpreter_free(&interp);
+    return 1;
+  }
+
+  /* Piped or redirected output: skip terminal emulation entirely */
+  static char out_buf[1 << 16];
+  if (!is_terminal(STDOUT_FILENO)) {
+    interp.headless = true;
+    setvbuf(stdout, out_buf, _IOFBF, sizeof(out_buf));
+  }
+  interp.batch_input = !is_terminal(STDIN_FILENO);
+
+  if (restore_from && (filename || compile_to)) {
+    fprintf(stderr, "--restore cannot be combined with a program file\n");
+    print_usage();
+    return 1;
+  }
+
+  if (compile_to && !filename) {
+    fprintf(stderr, "No program to compile\n");
+    print_usage();
+    return 1;
+  }
 
   /* Load file if specified */
-  if (filename) {
-    if (interpreter_load(&interp, filename)) {
+  if (compile_to) {
+    int status = 0;
+    if (!interpreter_load(&interp, filename) ||
+        !interpreter_save_binary(&interp, compile_to)) {
+      fprintf(stderr, "?%s ERROR\n",
+              interp.error_message ? interp.error_message : "COMPILE");
+      status = 1;
+    }
+    interpreter_free(&interp);
+    return status;
+  } else if (restore_from) {
+    int line;
+    size_t offset;
+    if (!snapshot_restore(&interp, restore_from, &line, &offset)) {
+      fprintf(stderr, "Cannot restore snapshot: %s\n", restore_from);
+      interpreter_free(&interp);
+      return 1;
+    }
+    /* A snapshot taken by a running program carries on where it left off;
+     * one taken at the prompt returns to it */
+    if (line != SNAPSHOT_NO_LINE)
+      interpreter_resume(&interp, line, offset);
+    else
+      repl(&interp);
+  } else if (filename) {
+    if (cache_load(&interp, filename, VERSION " " __DATE__ " " __TIME__)) {
       interpreter_run(&interp);
+    } else {
+      fprintf(stderr, "?%s ERROR\n",
+              interp.error_message ? interp.error_message : "LOAD");
+      interpreter_free(&interp);
+      return 1;
     }
   } else {
     /* Start REPL */
@@ -0,0 +1,340 @@
+#include "compile.h"
+#include "lexer.h"
+#include <string.h>
+
+/* The grammar below mirrors evaluate_expression and evaluate_factor token
+ * for token, so every operator is typed exactly as it will be met */
+typedef enum { TYPE_NUMBER, TYPE_STRING } ExprType;
+
+typedef struct {
+  Lexer lexer;
+  uint8_t *code;
+  bool mismatch;
+} Compiler;
+
+static ExprType expression(Compiler *c);
+
+static TokenType peek(Compiler *c) { return lexer_peek_type(&c->lexer); }
+
+static void skip(Compiler *c) {
+  Token token = lexer_next_token(&c->lexer);
+  token_free(&token);
+}
+
+/* Consume the next token if it has the given type; a missing one is left
+ * for RUN to report as SYNTAX */
+static void accept(Compiler *c, TokenType type) {
+  if (peek(c) == type)
+    skip(c);
+}
+
+static void require(Compiler *c, ExprType have, ExprType want) {
+  if (have != want)
+    c->mismatch = true;
+}
+
+static bool is_relation(TokenType type) {
+  return (type >= TOK_EQUAL && type <= TOK_GREATER_EQUAL) ||
+         (type >= TOK_STR_EQUAL && type <= TOK_STR_GREATER_EQUAL);
+}
+
+/* "H{}", a whole map, comes next */
+static bool whole_map(Compiler *c) {
+  Lexer ahead = c->lexer;
+  Token name = lexer_next_token(&ahead);
+  Token lbrace = lexer_next_token(&ahead);
+  bool match = name.type == TOK_IDENTIFIER && lbrace.type == TOK_LBRACE &&
+               lexer_peek_type(&ahead) == TOK_RBRACE;
+  token_free(&name);
+  token_free(&lbrace);
+  return match;
+}
+
+/* "(i, j)" after an array name, or "(lo TO hi)" and "()" where SORT and
+ * SEARCH take a range */
+static void subscripts(Compiler *c) {
+  skip(c);
+  while (true) {
+    TokenType type = peek(c);
+    if (type == TOK_RPAREN || type == TOK_EOF || type == TOK_COLON)
+      break;
+    if (type == TOK_COMMA || type == TOK_TO)
+      skip(c);
+    else
+      require(c, expression(c), TYPE_NUMBER);
+  }
+  accept(c, TOK_RPAREN);
+}
+
+/* "{key}" after a map name; "{}" is the whole map */
+static void map_key(Compiler *c) {
+  skip(c);
+  if (peek(c) != TOK_RBRACE)
+    require(c, expression(c), TYPE_STRING);
+  accept(c, TOK_RBRACE);
+}
+
+static ExprType factor(Compiler *c) {
+  Token token = lexer_next_token(&c->lexer);
+  TokenType type = token.type;
+  ExprType result = TYPE_NUMBER;
+  if (type == TOK_IDENTIFIER && token.text[strlen(token.text) - 1] == '$')
+    result = TYPE_STRING;
+  token_free(&token);
+
+  switch (type) {
+  case TOK_STRING:
+    return TYPE_STRING;
+  case TOK_IDENTIFIER:
+    if (peek(c) == TOK_LPAREN)
+      subscripts(c);
+    else if (peek(c) == TOK_LBRACE)
+      map_key(c);
+    return result;
+  case TOK_LPAREN:
+    /* The evaluator takes whatever follows as the closing parenthesis */
+    result = expression(c);
+    skip(c);
+    return result;
+  case TOK_CHR:
+  case TOK_STR:
+  case TOK_PEEK:
+    skip(c);
+    require(c, expression(c), TYPE_NUMBER);
+    skip(c);
+    return type == TOK_PEEK ? TYPE_NUMBER : TYPE_STRING;
+  case TOK_SEARCH:
+    /* The value sought has the array's type */
+    accept(c, TOK_LPAREN);
+    result = factor(c);
+    accept(c, TOK_COMMA);
+    require(c, expression(c), result);
+    accept(c, TOK_RPAREN);
+    return TYPE_NUMBER;
+  case TOK_EXISTS:
+    accept(c, TOK_LPAREN);
+    factor(c);
+    accept(c, TOK_RPAREN);
+    return TYPE_NUMBER;
+  case TOK_KEY:
+    accept(c, TOK_LPAREN);
+    factor(c);
+    accept(c, TOK_COMMA);
+    require(c, expression(c), TYPE_NUMBER);
+    accept(c, TOK_RPAREN);
+    return TYPE_STRING;
+  case TOK_RND:
+    accept(c, TOK_LPAREN);
+    require(c, expression(c), TYPE_NUMBER);
+    accept(c, TOK_RPAREN);
+    return TYPE_NUMBER;
+  case TOK_LEN:
+    accept(c, TOK_LPAREN);
+    if (whole_map(c))
+      factor(c);
+    else
+      require(c, expression(c), TYPE_STRING);
+    accept(c, TOK_RPAREN);
+    return TYPE_NUMBER;
+  default:
+    return TYPE_NUMBER; // The evaluator reads anything else as 0
+  }
+}
+
+/* The right operand of ^ is signs and a factor, like evaluate_exponent */
+static ExprType exponent(Compiler *c) {
+  TokenType sign = peek(c);
+  if (sign != TOK_MINUS && sign != TOK_PLUS)
+    return factor(c);
+  skip(c);
+  require(c, exponent(c), TYPE_NUMBER);
+  return TYPE_NUMBER;
+}
+
+static ExprType power(Compiler *c) {
+  ExprType left = factor(c);
+  while (peek(c) == TOK_POWER) {
+    skip(c);
+    require(c, left, TYPE_NUMBER);
+    require(c, exponent(c), TYPE_NUMBER);
+  }
+  return left;
+}
+
+static ExprType unary(Compiler *c) {
+  TokenType sign = peek(c);
+  if (sign != TOK_MINUS && sign != TOK_PLUS)
+    return power(c);
+  skip(c);
+  require(c, unary(c), TYPE_NUMBER);
+  return TYPE_NUMBER;
+}
+
+static ExprType term(Compiler *c) {
+  ExprType left = unary(c);
+  TokenType op;
+  while ((op = peek(c)) == TOK_MULTIPLY || op == TOK_DIVIDE) {
+    skip(c);
+    require(c, left, TYPE_NUMBER);
+    require(c, unary(c), TYPE_NUMBER);
+  }
+  return left;
+}
+
+static ExprType sum(Compiler *c) {
+  ExprType left = term(c);
+  TokenType op;
+  while ((op = peek(c)) == TOK_PLUS || op == TOK_MINUS || op == TOK_CONCAT) {
+    size_t pos = (size_t)c->lexer.position;
+    skip(c);
+    ExprType right = term(c);
+    if (left != right || (left == TYPE_STRING && op == TOK_MINUS))
+      c->mismatch = true;
+    else if (op != TOK_MINUS)
+      lexer_code_retype(c->code, pos,
+                        left == TYPE_STRING ? TOK_CONCAT : TOK_PLUS);
+  }
+  return left;
+}
+
+static ExprType relation(Compiler *c) {
+  ExprType left = sum(c);
+  TokenType op;
+  while (is_relation(op = peek(c))) {
+    size_t pos = (size_t)c->lexer.position;
+    skip(c);
+    ExprType right = sum(c);
+    int rank = op >= TOK_STR_EQUAL ? op - TOK_STR_EQUAL : op - TOK_EQUAL;
+    if (left != right)
+      c->mismatch = true;
+    else
+      lexer_code_retype(c->code, pos,
+                        (TokenType)((left == TYPE_STRING ? TOK_STR_EQUAL
+                                                         : TOK_EQUAL) +
+                                    rank));
+    left = TYPE_NUMBER;
+  }
+  return left;
+}
+
+static ExprType not_expression(Compiler *c) {
+  if (peek(c) != TOK_NOT)
+    return relation(c);
+  skip(c);
+  require(c, not_expression(c), TYPE_NUMBER);
+  return TYPE_NUMBER;
+}
+
+static ExprType logic(Compiler *c, TokenType op) {
+  ExprType left = op == TOK_OR ? logic(c, TOK_AND) : not_expression(c);
+  while (peek(c) == op) {
+    skip(c);
+    require(c, left, TYPE_NUMBER);
+    require(c, op == TOK_OR ? logic(c, TOK_AND) : not_expression(c),
+            TYPE_NUMBER);
+    left = TYPE_NUMBER;
+  }
+  return left;
+}
+
+static ExprType expression(Compiler *c) { return logic(c, TOK_OR); }
+
+static bool starts_expression(TokenType type) {
+  return type == TOK_NUMBER || type == TOK_STRING || type == TOK_IDENTIFIER ||
+         type == TOK_LPAREN || type == TOK_MINUS || type == TOK_PLUS ||
+         type == TOK_NOT || (type >= TOK_ABS && type <= TOK_KEY);
+}
+
+/* Types of a statement's arguments in order: N for a number, S for a
+ * string, * for either, the last repeating. NULL leaves them all free,
+ * for statements whose arguments are variables or typed by their own
+ * syntax. Called with the keyword consumed. */
+static const char *statement_args(Compiler *c, TokenType keyword) {
+  switch (keyword) {
+  case TOK_PRINT:
+  case TOK_INPUT:
+  case TOK_GET:
+    return peek(c) == TOK_HASH ? "N*" : NULL;
+  case TOK_IF:
+  case TOK_GOTO:
+  case TOK_GOSUB:
+  case TOK_DO:
+  case TOK_LOOP:
+  case TOK_WHILE:
+  case TOK_UNTIL:
+  case TOK_TRAP:
+  case TOK_RESTORE:
+  case TOK_POKE:
+  case TOK_PLOT:
+  case TOK_DRAW:
+  case TOK_BOX:
+  case TOK_CIRCLE:
+  case TOK_PAINT:
+  case TOK_CLOSE:
+    return "N";
+  case TOK_OPEN:
+    return "NNNS";
+  case TOK_BLOAD:
+  case TOK_BSAVE:
+    return "SN";
+  case TOK_SNAPSHOT:
+    return "S";
+  case TOK_SORT:
+    return "*N*";
+  default:
+    return NULL;
+  }
+}
+
+/* Statements are not parsed one by one: an assignment is recognised where
+ * a statement starts, and anything else is taken as expressions between
+ * keywords and delimiters, each checked against the statement's argument
+ * types, which covers every statement's arguments */
+bool compile_code(uint8_t *code) {
+  Compiler c;
+  lexer_init_code(&c.lexer, code);
+  c.code = code;
+  c.mismatch = false;
+
+  bool statement_start = true;
+  const char *args = NULL;
+  while (!c.mismatch) {
+    TokenType type = peek(&c);
+    if (type == TOK_EOF || type == TOK_NEWLINE)
+      break;
+    if (statement_start &&
+        (type == TOK_LET || type == TOK_IDENTIFIER || type == TOK_FOR)) {
+      /* FOR starts with an assignment to a numeric variable */
+      if (type != TOK_IDENTIFIER)
+        skip(&c);
+      if (peek(&c) == TOK_IDENTIFIER) {
+        ExprType target = factor(&c);
+        if (type == TOK_FOR)
+          require(&c, target, TYPE_NUMBER);
+        if (peek(&c) == TOK_EQUAL) {
+          skip(&c);
+          require(&c, expression(&c), target);
+        }
+      }
+      args = type == TOK_FOR ? "N" : NULL;
+      statement_start = false;
+    } else if (starts_expression(type)) {
+      ExprType have = expression(&c);
+      if (args && *args != '*')
+        require(&c, have, *args == 'S' ? TYPE_STRING : TYPE_NUMBER);
+      if (args && args[1])
+        args++;
+      statement_start = false;
+    } else {
+      skip(&c);
+      if (statement_start)
+        args = statement_args(&c, type);
+      statement_start =
+          type == TOK_COLON || type == TOK_THEN || type == TOK_ELSE;
+      if (statement_start)
+        args = NULL;
+    }
+  }
+  lexer_free(&c.lexer);
+  return !c.mismatch;
+}
@@ -0,0 +1,15 @@
+#ifndef COMPILE_H
+#define COMPILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Type pass over one pre-tokenized line, run before it executes. Every
+ * expression's type follows from names ($ for strings), literals and
+ * functions, so + and the relations between strings are rewritten in
+ * place to their string tokens and the evaluator's arithmetic never has
+ * to look for strings. Rewriting is idempotent. Returns false if an
+ * operator, argument or assignment mixes strings and numbers. */
+bool compile_code(uint8_t *code);
+
+#endif /* COMPILE_H */
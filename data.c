@@ -0,0 +1,201 @@
+#include "data.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+
+void data_init(DataPool *pool) { memset(pool, 0, sizeof(*pool)); }
+
+void data_clear(DataPool *pool) {
+  safe_free(pool->items);
+  safe_free(pool->strings);
+  safe_free(pool->intern);
+  safe_free(pool->lines);
+  data_init(pool);
+}
+
+/* Grow an array by doubling; elements are `size` bytes */
+static bool grow(void **array, int *capacity, int needed, size_t size) {
+  if (needed <= *capacity)
+    return true;
+  int cap = *capacity ? *capacity * 2 : 16;
+  while (cap < needed)
+    cap *= 2;
+  void *grown = safe_realloc(*array, *capacity * size, cap * size);
+  if (!grown)
+    return false;
+  *array = grown;
+  *capacity = cap;
+  return true;
+}
+
+static bool rehash(DataPool *pool, int size);
+
+/* Store a string once; returns its offset or UINT32_MAX */
+static uint32_t intern_string(DataPool *pool, const char *str, size_t len) {
+  if (pool->count * 2 >= pool->intern_size &&
+      !rehash(pool, pool->intern_size ? pool->intern_size * 2 : 64))
+    return UINT32_MAX;
+
+  uint32_t mask = (uint32_t)pool->intern_size - 1;
+  uint32_t slot = (uint32_t)hash_fnv1a(str, len, FNV_OFFSET_BASIS) & mask;
+  while (pool->intern[slot] != UINT32_MAX) {
+    const char *other = pool->strings + pool->items[pool->intern[slot]].string;
+    if (strncmp(other, str, len) == 0 && other[len] == '\0')
+      return pool->items[pool->intern[slot]].string;
+    slot = (slot + 1) & mask;
+  }
+
+  if (pool->strings_used + len + 1 > pool->strings_size) {
+    size_t size = pool->strings_size ? pool->strings_size * 2 : 256;
+    while (size < pool->strings_used + len + 1)
+      size *= 2;
+    char *grown = safe_realloc(pool->strings, pool->strings_size, size);
+    if (!grown)
+      return UINT32_MAX;
+    pool->strings = grown;
+    pool->strings_size = size;
+  }
+  uint32_t offset = (uint32_t)pool->strings_used;
+  memcpy(pool->strings + offset, str, len);
+  pool->strings[offset + len] = '\0';
+  pool->strings_used += len + 1;
+
+  /* The caller's item (index count) becomes the owner of this string */
+  pool->intern[slot] = (uint32_t)pool->count;
+  return offset;
+}
+
+static bool rehash(DataPool *pool, int size) {
+  uint32_t *table = safe_malloc(size * sizeof(uint32_t));
+  if (!table)
+    return false;
+  memset(table, 0xFF, size * sizeof(uint32_t));
+
+  /* Re-insert the first owner of each distinct string */
+  uint32_t mask = (uint32_t)size - 1;
+  for (int i = 0; i < pool->count; i++) {
+    const char *str = pool->strings + pool->items[i].string;
+    uint32_t slot =
+        (uint32_t)hash_fnv1a(str, strlen(str), FNV_OFFSET_BASIS) & mask;
+    bool seen = false;
+    while (table[slot] != UINT32_MAX) {
+      if (pool->items[table[slot]].string == pool->items[i].string) {
+        seen = true;
+        break;
+      }
+      slot = (slot + 1) & mask;
+    }
+    if (!seen)
+      table[slot] = (uint32_t)i;
+  }
+
+  safe_free(pool->intern);
+  pool->intern = table;
+  pool->intern_size = size;
+  return true;
+}
+
+/* Unquoted items that read fully as a decimal number are stored as one */
+static bool parse_number(const char *str, size_t len, double *out) {
+  if (len == 0) {
+    *out = 0;
+    return true;
+  }
+  if (!strchr("+-.0123456789", str[0]) || memchr(str, 'x', len) ||
+      memchr(str, 'X', len))
+    return false;
+  char buf[64];
+  if (len >= sizeof(buf))
+    return false;
+  memcpy(buf, str, len);
+  buf[len] = '\0';
+  char *end;
+  *out = strtod(buf, &end);
+  return *end == '\0';
+}
+
+bool data_add(DataPool *pool, int line_number, const char *text, size_t len) {
+  if (!pool->line_count ||
+      pool->lines[pool->line_count - 1].line_number != line_number) {
+    if (!grow((void **)&pool->lines, &pool->line_capacity,
+              pool->line_count + 1, sizeof(DataLine)))
+      return false;
+    pool->lines[pool->line_count].line_number = line_number;
+    pool->lines[pool->line_count].first_item = pool->count;
+    pool->line_count++;
+  }
+
+  const char *p = text;
+  const char *end = text + len;
+  while (true) {
+    while (p < end && *p == ' ')
+      p++;
+
+    const char *start;
+    size_t item_len;
+    bool quoted = p < end && *p == '"';
+    if (quoted) {
+      start = ++p;
+      while (p < end && *p != '"')
+        p++;
+      item_len = (size_t)(p - start);
+      while (p < end && *p != ',')
+        p++;
+    } else {
+      start = p;
+      while (p < end && *p != ',')
+        p++;
+      const char *last = p;
+      while (last > start && last[-1] == ' ')
+        last--;
+      item_len = (size_t)(last - start);
+    }
+
+    if (!grow((void **)&pool->items, &pool->capacity, pool->count + 1,
+              sizeof(DataItem)))
+      return false;
+    DataItem *item = &pool->items[pool->count];
+    item->is_number = !quoted && parse_number(start, item_len, &item->number);
+    if (!item->is_number)
+      item->number = 0;
+    item->string = intern_string(pool, start, item_len);
+    if (item->string == UINT32_MAX)
+      return false;
+    pool->count++;
+
+    if (p >= end)
+      break;
+    p++; // comma
+  }
+  return true;
+}
+
+void data_finish(DataPool *pool) {
+  safe_free(pool->intern);
+  pool->intern = NULL;
+  pool->intern_size = 0;
+  pool->next = 0;
+  pool->built = true;
+}
+
+const DataItem *data_read(DataPool *pool) {
+  if (pool->next >= pool->count)
+    return NULL;
+  return &pool->items[pool->next++];
+}
+
+const char *data_string(const DataPool *pool, const DataItem *item) {
+  return pool->strings + item->string;
+}
+
+void data_restore(DataPool *pool, int line_number) {
+  int lo = 0, hi = pool->line_count;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (pool->lines[mid].line_number < line_number)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  pool->next = lo < pool->line_count ? pool->lines[lo].first_item : pool->count;
+}
@@ -0,0 +1,56 @@
+#ifndef DATA_H
+#define DATA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* One DATA item, parsed once when the pool is built */
+typedef struct {
+  double number;   // Value when is_number
+  uint32_t string; // Offset of the item text in the pool's strings
+  bool is_number;  // Unquoted and numeric (or empty, which reads as 0)
+} DataItem;
+
+/* First item of each line holding DATA, for RESTORE <line> */
+typedef struct {
+  int line_number;
+  int first_item;
+} DataLine;
+
+/* Every DATA item of the program in order. READ is an index increment;
+ * identical strings are stored once. */
+typedef struct {
+  DataItem *items;
+  int count;
+  int capacity;
+  char *strings;
+  size_t strings_used;
+  size_t strings_size;
+  uint32_t *intern; // Build-time hash of item indices, for interning
+  int intern_size;
+  DataLine *lines;
+  int line_count;
+  int line_capacity;
+  int next; // READ cursor
+  bool built;
+} DataPool;
+
+void data_init(DataPool *pool);
+void data_clear(DataPool *pool);
+
+/* Append the items of one DATA statement; lines must arrive in program
+ * order. Returns false when out of memory. */
+bool data_add(DataPool *pool, int line_number, const char *text, size_t len);
+
+/* Finish building: drops build-only state */
+void data_finish(DataPool *pool);
+
+/* Next item, or NULL when out of data */
+const DataItem *data_read(DataPool *pool);
+const char *data_string(const DataPool *pool, const DataItem *item);
+
+/* Move the READ cursor to the first item at or after line_number */
+void data_restore(DataPool *pool, int line_number);
+
+#endif /* DATA_H */
@@ -17,6 +17,7 @@
 #endif
 #else
 #include <sys/ioctl.h>
+#include <sys/select.h>
 #include <termios.h>
 #include <unistd.h>
 #endif
@@ -29,8 +30,49 @@ static HANDLE hStdout;
 static HANDLE hStdin;
 #endif
 
+// Keyboard input is read in chunks so a paste arrives in a few reads
+static unsigned char input_buf[4096];
+static int input_len = 0;
+static int input_pos = 0;
+
+// Set while a paste is applied: all terminal output is skipped
+static bool term_quiet = false;
+
+// Wait up to `ms` milliseconds for keyboard input
+static bool input_ready(int ms) {
+  if (input_pos < input_len)
+    return true;
+#ifdef _WIN32
+  if (_kbhit())
+    return true;
+  if (ms > 0) {
+    Sleep(ms);
+    return _kbhit() != 0;
+  }
+  return false;
+#else
+  fd_set fds;
+  FD_ZERO(&fds);
+  FD_SET(STDIN_FILENO, &fds);
+  struct timeval tv = {0, ms * 1000};
+  return select(STDIN_FILENO + 1, &fds, NULL, NULL, &tv) > 0;
+#endif
+}
+
+static void term_write(const char *buf, size_t len) {
+  if (!term_quiet)
+    fwrite(buf, 1, len, stdout);
+}
+
+static void term_flush(void) {
+  if (!term_quiet)
+    fflush(stdout);
+}
+
 // Platform-abstracted terminal controls
 static void term_clear(void) {
+  if (term_quiet)
+    return;
 #ifdef _WIN32
   COORD coord = {0, 0};
   DWORD count;
@@ -45,6 +87,8 @@ static void term_clear(void) {
 }
 
 static void term_move_cursor(int row, int col) {
+  if (term_quiet)
+    return;
 #ifdef _WIN32
   COORD coord = {(SHORT)col, (SHORT)row};
   SetConsoleCursorPosition(hStdout, coord);
@@ -54,6 +98,8 @@ static void term_move_cursor(int row, int col) {
 }
 
 static void term_scroll_up(void) {
+  if (term_quiet)
+    return;
 #ifdef _WIN32
   CONSOLE_SCREEN_BUFFER_INFO csbi;
   GetConsoleScreenBufferInfo(hStdout, &csbi);
@@ -81,6 +127,7 @@ void editor_enable_raw_mode(void) {
   DWORD raw = orig_mode &
               ~(ENABLE_ECHO_INPUT | ENABLE_LINE_INPUT | ENABLE_PROCESSED_INPUT);
   SetConsoleMode(hStdin, raw);
+  SetConsoleOutputCP(CP_UTF8); // Braille graphics glyphs
 #else
   if (tcgetattr(STDIN_FILENO, &orig_termios) == -1)
     return;
@@ -94,6 +141,8 @@ void editor_enable_raw_mode(void) {
   raw.c_cc[VTIME] = 0;
 
   tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+  printf("\x1b[?2004h"); // Bracketed paste: ESC[200~ ... ESC[201~
+  fflush(stdout);
 #endif
 }
 
@@ -101,6 +150,8 @@ void editor_disable_raw_mode(void) {
 #ifdef _WIN32
   SetConsoleMode(hStdin, orig_mode);
 #else
+  printf("\x1b[?2004l");
+  fflush(stdout);
   tcsetattr(STDIN_FILENO, TCSAFLUSH, &orig_termios);
 #endif
 }
@@ -127,12 +178,37 @@ static void get_window_size(int *rows, int *cols) {
 #endif
 }
 
+// Offset of logical cell (row, col); scrolling rotates `top` instead of
+// moving the buffer
+static int cell_index(const Editor *ed, int row, int col) {
+  int phys = ed->top + row;
+  if (phys >= ed->rows)
+    phys -= ed->rows;
+  return phys * ed->cols + col;
+}
+
+static void reset_dirty(Editor *ed) {
+  ed->dirty_top = ed->rows;
+  ed->dirty_bottom = -1;
+  ed->dirty_left = ed->cols;
+  ed->dirty_right = -1;
+}
+
 void editor_init(Editor *ed) {
   get_window_size(&ed->rows, &ed->cols);
   ed->cursor_row = 0;
   ed->cursor_col = 0;
+  ed->top = 0;
   ed->buffer = safe_malloc(ed->rows * ed->cols);
   memset(ed->buffer, ' ', ed->rows * ed->cols);
+  ed->glyphs = safe_malloc(ed->rows * ed->cols);
+  memset(ed->glyphs, 0, ed->rows * ed->cols);
+  reset_dirty(ed);
+  ed->pasting = false;
+  ed->paste_burst = false;
+  ed->paste_line = NULL;
+  ed->paste_len = 0;
+  ed->paste_cap = 0;
 }
 
 void editor_free(Editor *ed) {
@@ -140,19 +216,41 @@ void editor_free(Editor *ed) {
     safe_free(ed->buffer);
     ed->buffer = NULL;
   }
+  if (ed->glyphs) {
+    safe_free(ed->glyphs);
+    ed->glyphs = NULL;
+  }
+  if (ed->paste_line) {
+    safe_free(ed->paste_line);
+    ed->paste_line = NULL;
+  }
 }
 
 void editor_clear_screen(Editor *ed) {
   memset(ed->buffer, ' ', ed->rows * ed->cols);
+  memset(ed->glyphs, 0, ed->rows * ed->cols);
+  ed->top = 0;
   ed->cursor_row = 0;
   ed->cursor_col = 0;
+  reset_dirty(ed);
   term_clear();
-  fflush(stdout);
+  term_flush();
 }
 
 void editor_scroll(Editor *ed) {
-  memmove(ed->buffer, ed->buffer + ed->cols, (ed->rows - 1) * ed->cols);
-  memset(ed->buffer + (ed->rows - 1) * ed->cols, ' ', ed->cols);
+  // The old top row is cleared and becomes the new bottom row
+  memset(ed->buffer + ed->top * ed->cols, ' ', ed->cols);
+  memset(ed->glyphs + ed->top * ed->cols, 0, ed->cols);
+  ed->top = (ed->top + 1) % ed->rows;
+
+  // Unflushed cells moved up with the rest of the screen
+  if (ed->dirty_bottom >= ed->dirty_top) {
+    ed->dirty_bottom--;
+    if (ed->dirty_top > 0)
+      ed->dirty_top--;
+    if (ed->dirty_bottom < ed->dirty_top)
+      reset_dirty(ed);
+  }
   ed->cursor_row--;
   if (ed->cursor_row < 0)
     ed->cursor_row = 0;
@@ -160,16 +258,34 @@ void editor_scroll(Editor *ed) {
   term_scroll_up();
 }
 
+// Write `n` cells of row `r` starting at column `c`, expanding braille
+// glyphs to UTF-8
+static void write_cells(Editor *ed, int r, int c, int n) {
+  const char *text = ed->buffer + cell_index(ed, r, c);
+  const uint8_t *glyph = ed->glyphs + cell_index(ed, r, c);
+  int run = 0;
+  for (int i = 0; i < n; i++) {
+    if (!glyph[i])
+      continue;
+    term_write(text + run, i - run);
+    char utf8[3] = {(char)0xE2, (char)(0xA0 | (glyph[i] >> 6)),
+                    (char)(0x80 | (glyph[i] & 0x3F))};
+    term_write(utf8, 3);
+    run = i + 1;
+  }
+  term_write(text + run, n - run);
+}
+
 void editor_refresh(Editor *ed) {
   // Basic refresh: clear screen and redraw from buffer
   term_move_cursor(0, 0);
   for (int r = 0; r < ed->rows; r++) {
-    fwrite(ed->buffer + r * ed->cols, 1, ed->cols, stdout);
+    write_cells(ed, r, 0, ed->cols);
     if (r < ed->rows - 1)
-      printf("\r\n");
+      term_write("\r\n", 2);
   }
   term_move_cursor(ed->cursor_row, ed->cursor_col);
-  fflush(stdout);
+  term_flush();
 }
 
 void editor_print(Editor *ed, const char *str) {
@@ -185,9 +301,10 @@ void editor_print(Editor *ed, const char *str) {
       if (ed->cursor_row >= ed->rows) {
         editor_scroll(ed);
       }
-      ed->buffer[ed->cursor_row * ed->cols + ed->cursor_col] = *str;
+      ed->buffer[cell_index(ed, ed->cursor_row, ed->cursor_col)] = *str;
+      ed->glyphs[cell_index(ed, ed->cursor_row, ed->cursor_col)] = 0;
       term_move_cursor(ed->cursor_row, ed->cursor_col);
-      putchar(*str);
+      term_write(str, 1);
       ed->cursor_col++;
     }
 
@@ -201,34 +318,138 @@ void editor_print(Editor *ed, const char *str) {
     str++;
   }
   term_move_cursor(ed->cursor_row, ed->cursor_col);
-  fflush(stdout);
+  term_flush();
+}
+
+static void begin_paste(Editor *ed, bool burst) {
+  ed->pasting = true;
+  ed->paste_burst = burst;
+  ed->paste_len = 0;
+  term_quiet = true;
+}
+
+// Leave paste mode and show the result with a single redraw
+static void end_paste(Editor *ed) {
+  ed->pasting = false;
+  ed->paste_burst = false;
+  term_quiet = false;
+  editor_refresh(ed);
 }
 
-static int get_char(void) {
+static int get_char(Editor *ed) {
+  // A burst paste ends when no more input follows shortly
+  if (ed->pasting && ed->paste_burst && !input_ready(10))
+    end_paste(ed);
+
 #ifdef _WIN32
   return _getch();
 #else
-  char c;
-  if (read(STDIN_FILENO, &c, 1) != 1) {
-    if (errno == EINTR)
+  if (input_pos >= input_len) {
+    ssize_t n = read(STDIN_FILENO, input_buf, sizeof(input_buf));
+    if (n <= 0) {
+      if (n < 0 && errno == EINTR)
+        return -1;
       return -1;
-    return -1;
+    }
+    input_len = (int)n;
+    input_pos = 0;
   }
-  return (unsigned char)c;
+  return input_buf[input_pos++];
 #endif
 }
 
+static void paste_append(Editor *ed, char c) {
+  if (ed->paste_len + 1 >= ed->paste_cap) {
+    size_t cap = ed->paste_cap ? ed->paste_cap * 2 : 256;
+    char *grown = safe_realloc(ed->paste_line, ed->paste_cap, cap);
+    if (!grown)
+      return;
+    ed->paste_line = grown;
+    ed->paste_cap = cap;
+  }
+  ed->paste_line[ed->paste_len++] = c;
+}
+
+static void insert_char(Editor *ed, char c) {
+  if (ed->cursor_row >= ed->rows) {
+    editor_scroll(ed);
+  }
+  ed->buffer[cell_index(ed, ed->cursor_row, ed->cursor_col)] = c;
+  ed->glyphs[cell_index(ed, ed->cursor_row, ed->cursor_col)] = 0;
+  term_write(&c, 1);
+  ed->cursor_col++;
+  if (ed->cursor_col >= ed->cols) {
+    ed->cursor_col = 0;
+    ed->cursor_row++;
+  }
+}
+
+static void next_row(Editor *ed) {
+  ed->cursor_row++;
+  ed->cursor_col = 0;
+  if (ed->cursor_row >= ed->rows) {
+    editor_scroll(ed);
+  }
+  term_move_cursor(ed->cursor_row, ed->cursor_col);
+  term_flush();
+}
+
+// Read the rest of an ESC sequence. Returns the final byte; for
+// ESC [ <digits> ~ the number is stored in *param.
+static int read_escape(Editor *ed, int *param) {
+  *param = 0;
+  int c = get_char(ed);
+  if (c != '[')
+    return c;
+  c = get_char(ed);
+  while (c >= '0' && c <= '9') {
+    *param = *param * 10 + (c - '0');
+    c = get_char(ed);
+  }
+  return c;
+}
+
+// Numbered lines only go into the program; anything else runs and must be
+// able to show output, so a paste is never left muted across it
+static bool is_program_line(const char *line) {
+  while (*line == ' ')
+    line++;
+  return isdigit((unsigned char)*line);
+}
+
 char *editor_read_line(Editor *ed) {
+  bool after_cr = false;
+  ed->paste_len = 0;
+
   while (1) {
-    int char_val = get_char();
+    int char_val = get_char(ed);
     if (char_val == -1)
       return NULL;
     char c = (char)char_val;
 
+    if (ed->pasting && (c == '\r' || c == '\n')) {
+      // Pasted lines are taken whole, not picked from the screen, so
+      // lines wider than the terminal survive
+      if (c == '\n' && after_cr) {
+        after_cr = false;
+        continue;
+      }
+      after_cr = (c == '\r');
+      char *line = safe_malloc(ed->paste_len + 1);
+      if (ed->paste_len)
+        memcpy(line, ed->paste_line, ed->paste_len);
+      line[ed->paste_len] = '\0';
+      next_row(ed);
+      if (!is_program_line(line))
+        end_paste(ed);
+      return line;
+    }
+    after_cr = false;
+
     if (c == '\r' || c == '\n') {
       // Pick the current line from logical screen
       int r = ed->cursor_row;
-      int start = r * ed->cols;
+      int start = cell_index(ed, r, 0);
       int end = start + ed->cols - 1;
 
       // Trim leading/trailing spaces for the "picked" line
@@ -247,20 +468,23 @@ char *editor_read_line(Editor *ed) {
         line = str_duplicate("");
       }
 
-      // Move cursor to next line
-      ed->cursor_row++;
-      ed->cursor_col = 0;
-      if (ed->cursor_row >= ed->rows) {
-        editor_scroll(ed);
-      }
-      term_move_cursor(ed->cursor_row, ed->cursor_col);
-      fflush(stdout);
+      // More input already waiting behind ENTER: nobody types that
+      // fast, so treat the rest as a paste
+      if (input_ready(0) && is_program_line(line))
+        begin_paste(ed, true);
+
+      next_row(ed);
       return line;
     } else if (c == 127 || c == 8) { // Backspace
+      if (ed->pasting) {
+        if (ed->paste_len > 0)
+          ed->paste_len--;
+      }
       if (ed->cursor_col > 0) {
         ed->cursor_col--;
-        ed->buffer[ed->cursor_row * ed->cols + ed->cursor_col] = ' ';
-        printf("\b \b");
+        ed->buffer[cell_index(ed, ed->cursor_row, ed->cursor_col)] = ' ';
+        ed->glyphs[cell_index(ed, ed->cursor_row, ed->cursor_col)] = 0;
+        term_write("\b \b", 3);
       }
     } else if (char_val == 224 || char_val == 0) { // Windows special keys
 #ifdef _WIN32
@@ -287,49 +511,53 @@ char *editor_read_line(Editor *ed) {
 #endif
     } else if (c == '\033') { // Escape sequence (POSIX)
 #ifndef _WIN32
-      char seq[3];
-      if (read(STDIN_FILENO, &seq[0], 1) != 1)
+      int param;
+      int final = read_escape(ed, &param);
+      if (final == -1)
+        return NULL;
+
+      if (final == '~' && param == 200) {
+        begin_paste(ed, false);
+        ed->paste_len = 0;
         continue;
-      if (read(STDIN_FILENO, &seq[1], 1) != 1)
+      }
+      if (final == '~' && param == 201) {
+        if (ed->pasting)
+          end_paste(ed);
         continue;
+      }
 
-      if (seq[0] == '[') {
-        switch (seq[1]) {
-        case 'A': // Up
-          if (ed->cursor_row > 0)
-            ed->cursor_row--;
-          break;
-        case 'B': // Down
-          if (ed->cursor_row < ed->rows - 1)
-            ed->cursor_row++;
-          break;
-        case 'C': // Right
-          if (ed->cursor_col < ed->cols - 1)
-            ed->cursor_col++;
-          break;
-        case 'D': // Left
-          if (ed->cursor_col > 0)
-            ed->cursor_col--;
-          break;
-        }
+      switch (final) {
+      case 'A': // Up
+        if (ed->cursor_row > 0)
+          ed->cursor_row--;
+        break;
+      case 'B': // Down
+        if (ed->cursor_row < ed->rows - 1)
+          ed->cursor_row++;
+        break;
+      case 'C': // Right
+        if (ed->cursor_col < ed->cols - 1)
+          ed->cursor_col++;
+        break;
+      case 'D': // Left
+        if (ed->cursor_col > 0)
+          ed->cursor_col--;
+        break;
       }
       term_move_cursor(ed->cursor_row, ed->cursor_col);
 #endif
+    } else if (c == '\t' && ed->pasting) {
+      paste_append(ed, ' ');
+      insert_char(ed, ' ');
     } else if (iscntrl(c)) {
       // Ignore other control codes
     } else {
-      if (ed->cursor_row >= ed->rows) {
-        editor_scroll(ed);
-      }
-      ed->buffer[ed->cursor_row * ed->cols + ed->cursor_col] = c;
-      putchar(c);
-      ed->cursor_col++;
-      if (ed->cursor_col >= ed->cols) {
-        ed->cursor_col = 0;
-        ed->cursor_row++;
-      }
+      if (ed->pasting)
+        paste_append(ed, c);
+      insert_char(ed, c);
     }
-    fflush(stdout);
+    term_flush();
   }
   return NULL;
 }
@@ -337,10 +565,55 @@ char *editor_read_line(Editor *ed) {
 void editor_plot(Editor *ed, int x, int y, char c) {
   if (x < 0 || x >= ed->cols || y < 0 || y >= ed->rows)
     return;
-  ed->buffer[y * ed->cols + x] = c;
+  ed->buffer[cell_index(ed, y, x)] = c;
+  ed->glyphs[cell_index(ed, y, x)] = 0;
   term_move_cursor(y, x);
-  putchar(c);
-  fflush(stdout);
+  term_write(&c, 1);
+  term_flush();
+}
+
+static void mark_dirty(Editor *ed, int x, int y) {
+  if (y < ed->dirty_top)
+    ed->dirty_top = y;
+  if (y > ed->dirty_bottom)
+    ed->dirty_bottom = y;
+  if (x < ed->dirty_left)
+    ed->dirty_left = x;
+  if (x > ed->dirty_right)
+    ed->dirty_right = x;
+}
+
+// Write a cell into the screen buffer only; editor_flush() sends it
+void editor_set_cell(Editor *ed, int x, int y, char c) {
+  if (x < 0 || x >= ed->cols || y < 0 || y >= ed->rows)
+    return;
+  ed->buffer[cell_index(ed, y, x)] = c;
+  ed->glyphs[cell_index(ed, y, x)] = 0;
+  mark_dirty(ed, x, y);
+}
+
+// Show a braille graphics glyph in a cell; pattern 0 blanks it
+void editor_set_glyph(Editor *ed, int x, int y, uint8_t pattern) {
+  if (x < 0 || x >= ed->cols || y < 0 || y >= ed->rows)
+    return;
+  ed->buffer[cell_index(ed, y, x)] = ' ';
+  ed->glyphs[cell_index(ed, y, x)] = pattern;
+  mark_dirty(ed, x, y);
+}
+
+// Redraw the dirty region in one pass and a single flush
+void editor_flush(Editor *ed) {
+  if (ed->dirty_bottom < ed->dirty_top)
+    return;
+
+  int width = ed->dirty_right - ed->dirty_left + 1;
+  for (int r = ed->dirty_top; r <= ed->dirty_bottom; r++) {
+    term_move_cursor(r, ed->dirty_left);
+    write_cells(ed, r, ed->dirty_left, width);
+  }
+  term_move_cursor(ed->cursor_row, ed->cursor_col);
+  term_flush();
+  reset_dirty(ed);
 }
 
 void editor_set_background_color(Editor *ed, int color) {
@@ -455,9 +728,35 @@ void editor_set_background_color(Editor *ed, int color) {
     ansi_bg = 100;
     break; // Grey 3
   }
-  printf("\x1b[%dm", ansi_bg);
+  char seq[16];
+  int len = snprintf(seq, sizeof(seq), "\x1b[%dm", ansi_bg);
+  term_write(seq, (size_t)len);
 #endif
-  fflush(stdout);
+  term_flush();
+}
+
+// Simple CBM screen code to ASCII conversion
+static char screen_glyph(uint8_t val) {
+  if (val == 0)
+    return '@';
+  if (val >= 1 && val <= 26)
+    return val + 64; // A-Z
+  if (val >= 27 && val <= 31)
+    return val + 64; // [ / ] ^ _
+  if (val >= 32 && val <= 63)
+    return val; // Space-?
+  if (val >= 64 && val <= 95)
+    return val + 32; // a-z
+  if (val >= 96 && val <= 127)
+    return val; // Graphics
+  return '?';   // Reverse video: no terminal equivalent
+}
+
+// Terminal cell that screen RAM `offset` (0-999) is scaled onto
+static int screen_cell(Editor *ed, int offset) {
+  int tr = (offset / 40) * ed->rows / 25;
+  int tc = (offset % 40) * ed->cols / 40;
+  return cell_index(ed, tr, tc);
 }
 
 void editor_poke_char(Editor *ed, int addr, uint8_t val) {
@@ -465,29 +764,43 @@ void editor_poke_char(Editor *ed, int addr, uint8_t val) {
   if (offset < 0 || offset >= 1000)
     return;
 
-  int r = offset / 40;
-  int c = offset % 40;
+  // Map to terminal grid (might need scaling)
+  int tr = (offset / 40) * ed->rows / 25;
+  int tc = (offset % 40) * ed->cols / 40;
 
-  // Simple CBM core code to ASCII conversion
-  char ch = ' ';
-  if (val >= 1 && val <= 26)
-    ch = val + 64; // A-Z
-  else if (val >= 27 && val <= 31)
-    ch = val + 64; // [ / ] ^ _
-  else if (val >= 32 && val <= 63)
-    ch = val; // Space-?
-  else if (val >= 64 && val <= 95)
-    ch = val + 32; // a-z
-  else if (val >= 96 && val <= 127)
-    ch = val; // Graphics
-  else
-    ch = '?'; // Fallback
+  // Buffered only: the caller batches cells and calls editor_flush()
+  editor_set_cell(ed, tc, tr, screen_glyph(val));
+}
 
-  // Map to terminal grid (might need scaling)
-  int tr = r * ed->rows / 25;
-  int tc = c * ed->cols / 40;
+// True while the cell for `addr` still shows what poking `val` draws, i.e.
+// nothing printed over it since
+bool editor_shows_char(Editor *ed, int addr, uint8_t val) {
+  int offset = addr - 1024;
+  if (offset < 0 || offset >= 1000)
+    return false;
+  int cell = screen_cell(ed, offset);
+  return !ed->glyphs[cell] && ed->buffer[cell] == screen_glyph(val);
+}
 
-  editor_plot(ed, tc, tr, ch);
+// Inverse of editor_poke_char: screen code of the cell shown for `addr`
+uint8_t editor_peek_char(Editor *ed, int addr) {
+  int offset = addr - 1024;
+  if (offset < 0 || offset >= 1000)
+    return 32;
+
+  unsigned char ch = (unsigned char)ed->buffer[screen_cell(ed, offset)];
+
+  if (ch == '@')
+    return 0;
+  if (ch >= 'A' && ch <= 'Z')
+    return ch - 64;
+  if (ch >= '[' && ch <= '_')
+    return ch - 64; // 27-31
+  if (ch >= 'a' && ch <= 'z')
+    return ch - 32; // 65-90
+  if (ch >= 32 && ch <= 63)
+    return ch;
+  return 32;
 }
 
 void editor_clear(Editor *ed) { editor_clear_screen(ed); }
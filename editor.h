@@ -10,7 +10,20 @@ typedef struct {
   int cols;
   int cursor_row;
   int cursor_col;
-  char *buffer; // Screen buffer
+  char *buffer; // Screen buffer, a ring of rows starting at `top`
+  int top;      // Physical row holding logical row 0
+  // Braille dot pattern per cell (U+2800 + pattern); 0 shows buffer text
+  uint8_t *glyphs;
+  // Region written by editor_set_cell() but not yet sent to the terminal;
+  // empty when dirty_bottom < dirty_top
+  int dirty_top, dirty_bottom;
+  int dirty_left, dirty_right;
+  // Paste in progress: lines are applied without echo and the screen is
+  // redrawn once when it ends
+  bool pasting;
+  bool paste_burst; // Detected by timing, not bracketed-paste markers
+  char *paste_line; // Current pasted line (may be wider than the screen)
+  size_t paste_len, paste_cap;
 } Editor;
 
 void editor_init(Editor *ed);
@@ -25,8 +38,13 @@ void editor_disable_raw_mode(void);
 void editor_print(Editor *ed, const char *str);
 void editor_scroll(Editor *ed);
 void editor_plot(Editor *ed, int x, int y, char c);
+void editor_set_cell(Editor *ed, int x, int y, char c);
+void editor_set_glyph(Editor *ed, int x, int y, uint8_t pattern);
+void editor_flush(Editor *ed);
 void editor_set_background_color(Editor *ed, int color);
 void editor_poke_char(Editor *ed, int addr, uint8_t val);
+uint8_t editor_peek_char(Editor *ed, int addr);
+bool editor_shows_char(Editor *ed, int addr, uint8_t val);
 
 // New: Platform-agnostic terminal controls
 void editor_clear(Editor *ed);
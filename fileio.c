@@ -0,0 +1,326 @@
+#include "fileio.h"
+#include "utils.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#define read_fd(fd, buf, len) _read(fd, buf, (unsigned)(len))
+#else
+#include <errno.h>
+#include <unistd.h>
+#define read_fd(fd, buf, len) read(fd, buf, len)
+#endif
+
+/* Size a new channel buffer from what the memory limit still allows;
+ * returns 0 when even a minimal buffer does not fit */
+static size_t buffer_size(void) {
+  size_t free_mem = get_free_memory();
+  size_t size = free_mem / 4;
+  if (size > CHANNEL_BUF_MAX)
+    size = CHANNEL_BUF_MAX;
+  if (size < CHANNEL_BUF_MIN)
+    return free_mem > CHANNEL_BUF_MIN * 2 ? CHANNEL_BUF_MIN : 0;
+  return size;
+}
+
+/* Split "[@][d:]name[,type][,mode]" into a host path and access mode */
+static char parse_name(const char *name, char *path, size_t path_size) {
+  if (*name == '@')
+    name++;
+  if (isdigit((unsigned char)name[0]) && name[1] == ':')
+    name += 2;
+
+  const char *comma = strchr(name, ',');
+  size_t len = comma ? (size_t)(comma - name) : strlen(name);
+  if (len >= path_size)
+    len = path_size - 1;
+  memcpy(path, name, len);
+  path[len] = '\0';
+
+  char mode = 0;
+  while (comma) {
+    char c = (char)toupper((unsigned char)comma[1]);
+    if (c == 'R' || c == 'W' || c == 'A')
+      mode = c;
+    comma = strchr(comma + 1, ',');
+  }
+  return mode;
+}
+
+const char *chan_open(Channel *channels, int lfn, int device, int sa,
+                      const char *name) {
+  if (lfn < 1 || lfn > 255)
+    return "ILLEGAL QUANTITY";
+  if (chan_find(channels, lfn))
+    return "FILE OPEN";
+
+  Channel *ch = NULL;
+  for (int i = 0; i < MAX_CHANNELS; i++) {
+    if (channels[i].lfn == 0) {
+      ch = &channels[i];
+      break;
+    }
+  }
+  if (!ch)
+    return "TOO MANY FILES";
+
+  char mode;
+  FILE *file = NULL;
+  if (device == DEV_KEYBOARD) {
+    /* Reads go through the shared stdin reader; no buffer of its own */
+    memset(ch, 0, sizeof(*ch));
+    ch->lfn = lfn;
+    ch->device = device;
+    return NULL;
+  } else if (device == DEV_SCREEN) {
+    mode = 'W';
+  } else if (device >= DEV_DISK && device <= 30) {
+    char path[1024];
+    mode = parse_name(name ? name : "", path, sizeof(path));
+    if (!mode)
+      mode = sa == 1 ? 'W' : 'R';
+    if (!path[0])
+      return "MISSING FILE NAME";
+    file = fopen(path, mode == 'R' ? "rb" : mode == 'W' ? "wb" : "ab");
+    if (!file)
+      return mode == 'R' ? "FILE NOT FOUND" : "CANNOT SAVE FILE";
+    /* Our buffer is the only one: stdio would copy everything twice */
+    setvbuf(file, NULL, _IONBF, 0);
+  } else {
+    return "DEVICE NOT PRESENT";
+  }
+
+  size_t size = buffer_size();
+  char *buf = size ? safe_malloc(size + 1) : NULL;
+  if (!buf) {
+    if (file)
+      fclose(file);
+    return "TOO MANY FILES";
+  }
+
+  ch->lfn = lfn;
+  ch->device = device;
+  ch->file = file;
+  ch->output = mode != 'R';
+  ch->eof = false;
+  ch->buf = buf;
+  ch->size = size;
+  ch->start = 0;
+  ch->end = 0;
+  return NULL;
+}
+
+Channel *chan_find(Channel *channels, int lfn) {
+  for (int i = 0; i < MAX_CHANNELS; i++) {
+    if (channels[i].lfn == lfn && lfn != 0)
+      return &channels[i];
+  }
+  return NULL;
+}
+
+void chan_close(Channel *ch) {
+  if (ch->output)
+    chan_flush(ch);
+  if (ch->file)
+    fclose(ch->file);
+  safe_free(ch->buf);
+  memset(ch, 0, sizeof(*ch));
+}
+
+void chan_close_all(Channel *channels) {
+  for (int i = 0; i < MAX_CHANNELS; i++) {
+    if (channels[i].lfn)
+      chan_close(&channels[i]);
+  }
+}
+
+bool chan_flush(Channel *ch) {
+  if (!ch->file || ch->end == 0)
+    return true;
+  size_t len = ch->end;
+  ch->end = 0;
+  return fwrite(ch->buf, 1, len, ch->file) == len;
+}
+
+bool chan_write(Channel *ch, const char *data, size_t len) {
+  if (ch->end + len > ch->size) {
+    if (!chan_flush(ch))
+      return false;
+    if (len > ch->size)
+      return fwrite(data, 1, len, ch->file) == len;
+  }
+  memcpy(ch->buf + ch->end, data, len);
+  ch->end += len;
+  return true;
+}
+
+Channel *chan_stdin(void) {
+  static Channel in;
+  if (!in.buf) {
+    /* Interpreter input, not BASIC memory: not counted against -M */
+    in.buf = malloc(STDIN_BUF_SIZE + 1);
+    if (!in.buf) {
+      error("SYSTEM OUT OF MEMORY");
+      exit(1);
+    }
+    in.device = DEV_KEYBOARD;
+    in.file = stdin;
+    in.host = true;
+    in.size = STDIN_BUF_SIZE;
+  }
+  return &in;
+}
+
+static Channel *input_of(Channel *ch) {
+  return ch->device == DEV_KEYBOARD ? chan_stdin() : ch;
+}
+
+/* Whatever stdin has ready, at least one byte unless at end of file. A
+ * pipe or terminal that stays open is answered line by line this way,
+ * where fread would wait for a full buffer. */
+static size_t read_available(FILE *file, char *buf, size_t len) {
+  /* Output waiting in the stdout buffer must be seen before we block */
+  fflush(stdout);
+#ifdef _WIN32
+  int got = read_fd(_fileno(file), buf, len);
+#else
+  ssize_t got;
+  do {
+    got = read_fd(fileno(file), buf, len);
+  } while (got < 0 && errno == EINTR);
+#endif
+  return got > 0 ? (size_t)got : 0;
+}
+
+/* Move unread bytes to the front and read more behind them. A full
+ * buffer holding one partial line is doubled. Returns false when no new
+ * bytes arrived. */
+static bool fill(Channel *ch) {
+  if (ch->eof)
+    return false;
+  if (ch->start > 0) {
+    memmove(ch->buf, ch->buf + ch->start, ch->end - ch->start);
+    ch->end -= ch->start;
+    ch->start = 0;
+  }
+  if (ch->end == ch->size) {
+    char *grown = ch->host ? realloc(ch->buf, ch->size * 2 + 1)
+                           : safe_realloc(ch->buf, ch->size + 1,
+                                          ch->size * 2 + 1);
+    if (!grown)
+      return false;
+    ch->buf = grown;
+    ch->size *= 2;
+  }
+  size_t want = ch->size - ch->end;
+  size_t got = ch->device == DEV_KEYBOARD
+                   ? read_available(ch->file, ch->buf + ch->end, want)
+                   : fread(ch->buf + ch->end, 1, want, ch->file);
+  if (got == 0) {
+    ch->eof = true;
+    return false;
+  }
+  // A short read from a file that stopped at its end needs no probe later
+  if (got < want && ch->device != DEV_KEYBOARD && feof(ch->file))
+    ch->eof = true;
+  ch->end += got;
+  return true;
+}
+
+char *field_split(char **pos, char *end, bool *more) {
+  char *p = *pos;
+  while (p < end && *p == ' ')
+    p++;
+
+  char *field = p;
+  char *field_end;
+  if (p < end && *p == '"') {
+    field = ++p;
+    while (p < end && *p != '"')
+      p++;
+    field_end = p;
+    while (p < end && *p != ',')
+      p++;
+  } else {
+    while (p < end && *p != ',')
+      p++;
+    field_end = p;
+    while (field_end > field && field_end[-1] == ' ')
+      field_end--;
+  }
+
+  *more = p < end;
+  *pos = *more ? p + 1 : p;
+  *field_end = '\0';
+  return field;
+}
+
+/* Make sure the whole current line is buffered; returns its end (the
+ * newline, or the end of the data at end of file) or NULL at end of file */
+static char *current_line(Channel *ch) {
+  if (ch->start == ch->end && !fill(ch))
+    return NULL;
+
+  char *nl;
+  size_t scanned = 0;
+  while (!(nl = memchr(ch->buf + ch->start + scanned, '\n',
+                       ch->end - ch->start - scanned))) {
+    scanned = ch->end - ch->start;
+    if (!fill(ch))
+      break;
+  }
+  return nl ? nl : ch->buf + ch->end;
+}
+
+/* Step past the line ending at `line_end` */
+static void consume_line(Channel *ch, char *line_end) {
+  ch->start = (size_t)(line_end - ch->buf);
+  if (ch->start < ch->end)
+    ch->start++; // newline
+}
+
+static char *strip_cr(char *start, char *line_end) {
+  if (line_end > start && line_end[-1] == '\r')
+    line_end--;
+  return line_end;
+}
+
+char *chan_line(Channel *ch) {
+  ch = input_of(ch);
+  char *line_end = current_line(ch);
+  if (!line_end)
+    return NULL;
+  char *line = ch->buf + ch->start;
+  consume_line(ch, line_end);
+  *strip_cr(line, line_end) = '\0';
+  return line;
+}
+
+char *chan_field(Channel *ch, bool *more) {
+  ch = input_of(ch);
+  char *line_end = current_line(ch);
+  if (!line_end)
+    return NULL;
+
+  char *pos = ch->buf + ch->start;
+  char *field = field_split(&pos, strip_cr(pos, line_end), more);
+  if (*more)
+    ch->start = (size_t)(pos - ch->buf);
+  else
+    consume_line(ch, line_end);
+  return field;
+}
+
+bool chan_eof(Channel *ch) {
+  ch = input_of(ch);
+  return ch->start == ch->end && ch->eof;
+}
+
+int chan_getc(Channel *ch) {
+  ch = input_of(ch);
+  if (ch->start == ch->end && !fill(ch))
+    return -1;
+  return (unsigned char)ch->buf[ch->start++];
+}
@@ -0,0 +1,70 @@
+#ifndef FILEIO_H
+#define FILEIO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/* CBM-style logical files (OPEN lfn,dev,sa,"name") mapped to host files.
+ * Each channel owns one large buffer counted against the memory limit;
+ * the host FILE is unbuffered so data is copied only once. */
+#define MAX_CHANNELS 10 // Open files at once, as in the CBM kernal
+#define CHANNEL_BUF_MAX (64 * 1024)
+#define CHANNEL_BUF_MIN 256
+#define STDIN_BUF_SIZE (64 * 1024)
+
+/* Devices */
+#define DEV_KEYBOARD 0 // Reads stdin through chan_stdin()
+#define DEV_SCREEN 3   // Writes go to the screen
+#define DEV_DISK 8     // 8 and up: host files
+
+typedef struct {
+  int lfn; // Logical file number, 0 when the slot is free
+  int device;
+  FILE *file; // NULL for the screen
+  bool output;
+  bool host;  // Buffer is interpreter memory, not counted against -M
+  bool eof;   // Input: nothing left past `end`
+  char *buf;  // Input: unread bytes are buf[start..end)
+  size_t size; // Output: pending bytes are buf[0..end)
+  size_t start;
+  size_t end;
+} Channel;
+
+/* Open a channel; returns NULL or a CBM error message */
+const char *chan_open(Channel *channels, int lfn, int device, int sa,
+                      const char *name);
+Channel *chan_find(Channel *channels, int lfn);
+void chan_close(Channel *channel);
+void chan_close_all(Channel *channels);
+
+/* Output; false on a host write error */
+bool chan_write(Channel *channel, const char *data, size_t len);
+bool chan_flush(Channel *channel);
+
+/* The one reader of stdin, shared by the stream REPL, INPUT and files
+ * opened on the keyboard so none of them can steal the others' input */
+Channel *chan_stdin(void);
+
+/* Next line without its line ending, NUL-terminated in place. Valid until
+ * the next read from the channel; NULL at end of file. */
+char *chan_line(Channel *channel);
+
+/* Next comma- or line-separated field, NUL-terminated in place. `more` is
+ * set when another field follows on the same line. Valid until the next
+ * read from the channel; NULL at end of file. */
+char *chan_field(Channel *channel, bool *more);
+
+/* Split the next field off a line in place: leading spaces dropped,
+ * quotes removed, trailing spaces trimmed. Advances *pos past the comma
+ * and sets `more` when there was one. */
+char *field_split(char **pos, char *end, bool *more);
+
+/* Next byte for GET#, or -1 at end of file */
+int chan_getc(Channel *channel);
+
+/* True once an input channel has hit end of file and everything before it
+ * has been read (ST = 64). Never reads, so it cannot block on stdin. */
+bool chan_eof(Channel *channel);
+
+#endif /* FILEIO_H */
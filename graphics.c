@@ -0,0 +1,330 @@
+#include "graphics.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ROW_BYTES (GFX_WIDTH / 8)
+
+void gfx_clear(Bitmap *bm) {
+  memset(bm->bits, 0, sizeof(bm->bits));
+  memset(bm->dirty, 0, sizeof(bm->dirty));
+  bm->any_dirty = false;
+}
+
+static void mark_dirty(Bitmap *bm, int x, int y) {
+  int block = (y >> 2) * GFX_BLOCK_COLS + (x >> 1);
+  bm->dirty[block >> 3] |= (uint8_t)(1 << (block & 7));
+  bm->any_dirty = true;
+}
+
+void gfx_set_pixel(Bitmap *bm, int x, int y) {
+  if (x < 0 || x >= GFX_WIDTH || y < 0 || y >= GFX_HEIGHT)
+    return;
+  uint8_t *byte = &bm->bits[y * ROW_BYTES + (x >> 3)];
+  uint8_t mask = (uint8_t)(0x80 >> (x & 7));
+  if (*byte & mask)
+    return; // Already set: nothing to redraw
+  *byte |= mask;
+  mark_dirty(bm, x, y);
+}
+
+bool gfx_get_pixel(const Bitmap *bm, int x, int y) {
+  if (x < 0 || x >= GFX_WIDTH || y < 0 || y >= GFX_HEIGHT)
+    return false;
+  return (bm->bits[y * ROW_BYTES + (x >> 3)] & (0x80 >> (x & 7))) != 0;
+}
+
+enum { CLIP_LEFT = 1, CLIP_RIGHT = 2, CLIP_TOP = 4, CLIP_BOTTOM = 8 };
+
+static int clip_outcode(double x, double y) {
+  int code = 0;
+  if (x < 0)
+    code |= CLIP_LEFT;
+  else if (x > GFX_WIDTH - 1)
+    code |= CLIP_RIGHT;
+  if (y < 0)
+    code |= CLIP_TOP;
+  else if (y > GFX_HEIGHT - 1)
+    code |= CLIP_BOTTOM;
+  return code;
+}
+
+/* Cohen-Sutherland: trim a segment to the viewport. Returns false when the
+ * segment lies entirely outside it. */
+static bool clip_line(double *x1, double *y1, double *x2, double *y2) {
+  int code1 = clip_outcode(*x1, *y1);
+  int code2 = clip_outcode(*x2, *y2);
+
+  while (true) {
+    if (!(code1 | code2))
+      return true;
+    if (code1 & code2)
+      return false;
+
+    int out = code1 ? code1 : code2;
+    double x = 0, y = 0;
+    if (out & CLIP_BOTTOM) {
+      x = *x1 + (*x2 - *x1) * (GFX_HEIGHT - 1 - *y1) / (*y2 - *y1);
+      y = GFX_HEIGHT - 1;
+    } else if (out & CLIP_TOP) {
+      x = *x1 + (*x2 - *x1) * (0 - *y1) / (*y2 - *y1);
+      y = 0;
+    } else if (out & CLIP_RIGHT) {
+      y = *y1 + (*y2 - *y1) * (GFX_WIDTH - 1 - *x1) / (*x2 - *x1);
+      x = GFX_WIDTH - 1;
+    } else {
+      y = *y1 + (*y2 - *y1) * (0 - *x1) / (*x2 - *x1);
+      x = 0;
+    }
+
+    if (out == code1) {
+      *x1 = x;
+      *y1 = y;
+      code1 = clip_outcode(x, y);
+    } else {
+      *x2 = x;
+      *y2 = y;
+      code2 = clip_outcode(x, y);
+    }
+  }
+}
+
+void gfx_line(Bitmap *bm, int x1, int y1, int x2, int y2) {
+  double cx1 = x1, cy1 = y1, cx2 = x2, cy2 = y2;
+  if (!clip_line(&cx1, &cy1, &cx2, &cy2))
+    return;
+
+  x1 = (int)(cx1 + 0.5);
+  y1 = (int)(cy1 + 0.5);
+  x2 = (int)(cx2 + 0.5);
+  y2 = (int)(cy2 + 0.5);
+
+  int dx = abs(x2 - x1);
+  int dy = abs(y2 - y1);
+  int sx = (x1 < x2) ? 1 : -1;
+  int sy = (y1 < y2) ? 1 : -1;
+  int err = dx - dy;
+
+  while (1) {
+    gfx_set_pixel(bm, x1, y1);
+    if (x1 == x2 && y1 == y2)
+      break;
+    int e2 = 2 * err;
+    if (e2 > -dy) {
+      err -= dy;
+      x1 += sx;
+    }
+    if (e2 < dx) {
+      err += dx;
+      y1 += sy;
+    }
+  }
+}
+
+static void hline(Bitmap *bm, int x1, int x2, int y) {
+  if (y < 0 || y >= GFX_HEIGHT)
+    return;
+  if (x1 > x2) {
+    int t = x1;
+    x1 = x2;
+    x2 = t;
+  }
+  if (x1 < 0)
+    x1 = 0;
+  if (x2 > GFX_WIDTH - 1)
+    x2 = GFX_WIDTH - 1;
+  for (int x = x1; x <= x2; x++)
+    gfx_set_pixel(bm, x, y);
+}
+
+void gfx_box(Bitmap *bm, int x1, int y1, int x2, int y2, bool fill) {
+  if (y1 > y2) {
+    int t = y1;
+    y1 = y2;
+    y2 = t;
+  }
+  if (fill) {
+    int top = y1 < 0 ? 0 : y1;
+    int bottom = y2 > GFX_HEIGHT - 1 ? GFX_HEIGHT - 1 : y2;
+    for (int y = top; y <= bottom; y++)
+      hline(bm, x1, x2, y);
+    return;
+  }
+  hline(bm, x1, x2, y1);
+  hline(bm, x1, x2, y2);
+  gfx_line(bm, x1, y1, x1, y2);
+  gfx_line(bm, x2, y1, x2, y2);
+}
+
+/* Midpoint circle: one octant computed, eight plotted */
+void gfx_circle(Bitmap *bm, int cx, int cy, int r) {
+  if (r < 0)
+    r = -r;
+  int x = r;
+  int y = 0;
+  int err = 1 - r;
+
+  while (x >= y) {
+    gfx_set_pixel(bm, cx + x, cy + y);
+    gfx_set_pixel(bm, cx - x, cy + y);
+    gfx_set_pixel(bm, cx + x, cy - y);
+    gfx_set_pixel(bm, cx - x, cy - y);
+    gfx_set_pixel(bm, cx + y, cy + x);
+    gfx_set_pixel(bm, cx - y, cy + x);
+    gfx_set_pixel(bm, cx + y, cy - x);
+    gfx_set_pixel(bm, cx - y, cy - x);
+    y++;
+    if (err < 0) {
+      err += 2 * y + 1;
+    } else {
+      x--;
+      err += 2 * (y - x) + 1;
+    }
+  }
+}
+
+typedef struct {
+  int16_t x, y;
+} Seed;
+
+/* Queue the leftmost pixel of every clear run in row y between x1..x2 */
+static bool push_runs(Seed **stack, int *count, int *capacity,
+                      const Bitmap *bm, int x1, int x2, int y) {
+  if (y < 0 || y >= GFX_HEIGHT)
+    return true;
+  bool in_run = false;
+  for (int x = x1; x <= x2; x++) {
+    bool clear = !gfx_get_pixel(bm, x, y);
+    if (clear && !in_run) {
+      if (*count == *capacity) {
+        Seed *grown = safe_realloc(*stack, *capacity * sizeof(Seed),
+                                   *capacity * 2 * sizeof(Seed));
+        if (!grown)
+          return false;
+        *stack = grown;
+        *capacity *= 2;
+      }
+      (*stack)[*count].x = (int16_t)x;
+      (*stack)[*count].y = (int16_t)y;
+      (*count)++;
+    }
+    in_run = clear;
+  }
+  return true;
+}
+
+/* Scanline flood fill of the clear region containing (x, y), using an
+ * explicit seed stack instead of recursion */
+void gfx_paint(Bitmap *bm, int x, int y) {
+  if (x < 0 || x >= GFX_WIDTH || y < 0 || y >= GFX_HEIGHT ||
+      gfx_get_pixel(bm, x, y))
+    return;
+
+  int capacity = 256;
+  int count = 0;
+  Seed *stack = safe_malloc(capacity * sizeof(Seed));
+  if (!stack)
+    return;
+  stack[count].x = (int16_t)x;
+  stack[count].y = (int16_t)y;
+  count++;
+
+  while (count > 0) {
+    Seed s = stack[--count];
+    if (gfx_get_pixel(bm, s.x, s.y))
+      continue;
+
+    int left = s.x;
+    while (left > 0 && !gfx_get_pixel(bm, left - 1, s.y))
+      left--;
+    int right = s.x;
+    while (right < GFX_WIDTH - 1 && !gfx_get_pixel(bm, right + 1, s.y))
+      right++;
+
+    hline(bm, left, right, s.y);
+    if (!push_runs(&stack, &count, &capacity, bm, left, right, s.y - 1) ||
+        !push_runs(&stack, &count, &capacity, bm, left, right, s.y + 1))
+      break;
+  }
+
+  safe_free(stack);
+}
+
+static bool any_pixel(const Bitmap *bm, int x0, int y0, int x1, int y1) {
+  for (int y = y0; y < y1; y++) {
+    for (int x = x0; x < x1; x++) {
+      if (gfx_get_pixel(bm, x, y))
+        return true;
+    }
+  }
+  return false;
+}
+
+/* Braille dot bits, indexed [row][column] of the 2x4 cell */
+static const uint8_t braille_dots[4][2] = {
+    {0x01, 0x08}, {0x02, 0x10}, {0x04, 0x20}, {0x40, 0x80}};
+
+/* Build the glyph for terminal cell (row, col). The cell covers a pixel
+ * rectangle of the bitmap; each braille dot lights if any pixel in its
+ * share of that rectangle is set. */
+static uint8_t cell_pattern(const Bitmap *bm, const Editor *ed, int row,
+                            int col) {
+  int x0 = col * GFX_WIDTH / ed->cols;
+  int x1 = (col + 1) * GFX_WIDTH / ed->cols;
+  int y0 = row * GFX_HEIGHT / ed->rows;
+  int y1 = (row + 1) * GFX_HEIGHT / ed->rows;
+  uint8_t pattern = 0;
+
+  for (int dy = 0; dy < 4; dy++) {
+    int sy0 = y0 + dy * (y1 - y0) / 4;
+    int sy1 = y0 + (dy + 1) * (y1 - y0) / 4;
+    if (sy1 <= sy0)
+      sy1 = sy0 + 1;
+    for (int dx = 0; dx < 2; dx++) {
+      int sx0 = x0 + dx * (x1 - x0) / 2;
+      int sx1 = x0 + (dx + 1) * (x1 - x0) / 2;
+      if (sx1 <= sx0)
+        sx1 = sx0 + 1;
+      if (any_pixel(bm, sx0, sy0, sx1, sy1))
+        pattern |= braille_dots[dy][dx];
+    }
+  }
+  return pattern;
+}
+
+void gfx_render(Bitmap *bm, Editor *ed) {
+  if (!bm->any_dirty)
+    return;
+
+  int last_row = -1, last_col = -1;
+  for (int i = 0; i < (int)sizeof(bm->dirty); i++) {
+    if (!bm->dirty[i])
+      continue;
+    for (int bit = 0; bit < 8; bit++) {
+      if (!(bm->dirty[i] & (1 << bit)))
+        continue;
+      int block = i * 8 + bit;
+      int px = (block % GFX_BLOCK_COLS) * 2;
+      int py = (block / GFX_BLOCK_COLS) * 4;
+
+      // A block can straddle a cell boundary when the terminal is not an
+      // exact fraction of 160x50 cells
+      int c0 = px * ed->cols / GFX_WIDTH;
+      int c1 = (px + 1) * ed->cols / GFX_WIDTH;
+      int r0 = py * ed->rows / GFX_HEIGHT;
+      int r1 = (py + 3) * ed->rows / GFX_HEIGHT;
+      for (int r = r0; r <= r1; r++) {
+        for (int c = c0; c <= c1; c++) {
+          if (r == last_row && c == last_col)
+            continue;
+          editor_set_glyph(ed, c, r, cell_pattern(bm, ed, r, c));
+          last_row = r;
+          last_col = c;
+        }
+      }
+    }
+    bm->dirty[i] = 0;
+  }
+  bm->any_dirty = false;
+  editor_flush(ed);
+}
@@ -0,0 +1,41 @@
+#ifndef GRAPHICS_H
+#define GRAPHICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "editor.h"
+
+/* C64/C128 high-resolution graphics viewport */
+#define GFX_WIDTH 320
+#define GFX_HEIGHT 200
+
+/* Largest |coordinate| the drawing statements accept, so that clipping
+ * arithmetic stays inside int */
+#define GFX_COORD_MAX 32767
+
+/* Pixels are rendered as Unicode braille, one 2x4 block per glyph */
+#define GFX_BLOCK_COLS (GFX_WIDTH / 2)
+#define GFX_BLOCK_ROWS (GFX_HEIGHT / 4)
+
+/* 1-bit framebuffer at native resolution. Rows are 40 bytes, MSB first,
+ * like the C64 bitmap. `dirty` holds one bit per 2x4 block changed since
+ * the last gfx_render(). */
+typedef struct {
+  uint8_t bits[GFX_WIDTH * GFX_HEIGHT / 8];
+  uint8_t dirty[GFX_BLOCK_COLS * GFX_BLOCK_ROWS / 8];
+  bool any_dirty;
+} Bitmap;
+
+void gfx_clear(Bitmap *bm);
+void gfx_set_pixel(Bitmap *bm, int x, int y);
+bool gfx_get_pixel(const Bitmap *bm, int x, int y);
+void gfx_line(Bitmap *bm, int x1, int y1, int x2, int y2);
+void gfx_box(Bitmap *bm, int x1, int y1, int x2, int y2, bool fill);
+void gfx_circle(Bitmap *bm, int cx, int cy, int r);
+void gfx_paint(Bitmap *bm, int x, int y);
+
+/* Convert dirty blocks to braille glyphs on the editor and flush once */
+void gfx_render(Bitmap *bm, Editor *ed);
+
+#endif /* GRAPHICS_H */
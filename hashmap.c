@@ -0,0 +1,146 @@
+#include "hashmap.h"
+#include "utils.h"
+#include <string.h>
+
+#define MAP_MIN_CAPACITY 8
+
+void map_init(HashMap *map, bool strings) {
+  map->entries = NULL;
+  map->count = 0;
+  map->capacity = 0;
+  map->slots = NULL;
+  map->slot_count = 0;
+  map->strings = strings;
+}
+
+static void entry_free(HashMap *map, MapEntry *entry) {
+  safe_free(entry->key);
+  if (map->strings)
+    safe_free(entry->value.string);
+}
+
+void map_free(HashMap *map) {
+  for (size_t i = 0; i < map->count; i++)
+    entry_free(map, &map->entries[i]);
+  safe_free(map->entries);
+  safe_free(map->slots);
+  map_init(map, map->strings);
+}
+
+static uint64_t key_hash(const char *key) {
+  return hash_fnv1a(key, strlen(key), FNV_OFFSET_BASIS);
+}
+
+/* Slot holding the index of key's entry, or the empty slot ending its
+ * probe sequence. The table must exist. */
+static size_t find_slot(const HashMap *map, const char *key, uint64_t hash) {
+  size_t mask = map->slot_count - 1;
+  size_t slot = (size_t)hash & mask;
+  while (map->slots[slot] != UINT32_MAX) {
+    const MapEntry *entry = &map->entries[map->slots[slot]];
+    if (entry->hash == hash && strcmp(entry->key, key) == 0)
+      break;
+    slot = (slot + 1) & mask;
+  }
+  return slot;
+}
+
+MapEntry *map_find(const HashMap *map, const char *key) {
+  if (!map->count)
+    return NULL;
+  uint32_t index = map->slots[find_slot(map, key, key_hash(key))];
+  return index == UINT32_MAX ? NULL : &map->entries[index];
+}
+
+/* Double the entries and rebuild the table at twice their number, so it
+ * is never more than half full */
+static bool map_grow(HashMap *map) {
+  size_t capacity = map->capacity ? map->capacity * 2 : MAP_MIN_CAPACITY;
+  size_t slot_count = capacity * 2;
+  if (slot_count > UINT32_MAX)
+    return false;
+  uint32_t *slots = safe_malloc(slot_count * sizeof(uint32_t));
+  if (!slots)
+    return false;
+  MapEntry *entries =
+      safe_realloc(map->entries, map->capacity * sizeof(MapEntry),
+                   capacity * sizeof(MapEntry));
+  if (!entries) {
+    safe_free(slots);
+    return false;
+  }
+
+  memset(slots, 0xFF, slot_count * sizeof(uint32_t));
+  size_t mask = slot_count - 1;
+  for (size_t i = 0; i < map->count; i++) {
+    size_t slot = (size_t)entries[i].hash & mask;
+    while (slots[slot] != UINT32_MAX)
+      slot = (slot + 1) & mask;
+    slots[slot] = (uint32_t)i;
+  }
+  safe_free(map->slots);
+  map->entries = entries;
+  map->capacity = capacity;
+  map->slots = slots;
+  map->slot_count = slot_count;
+  return true;
+}
+
+MapEntry *map_insert(HashMap *map, const char *key) {
+  uint64_t hash = key_hash(key);
+  if (map->count) {
+    uint32_t index = map->slots[find_slot(map, key, hash)];
+    if (index != UINT32_MAX)
+      return &map->entries[index];
+  }
+  if (map->count == map->capacity && !map_grow(map))
+    return NULL;
+  char *copy = str_duplicate(key);
+  if (!copy)
+    return NULL;
+
+  map->slots[find_slot(map, key, hash)] = (uint32_t)map->count;
+  MapEntry *entry = &map->entries[map->count++];
+  entry->key = copy;
+  entry->hash = hash;
+  if (map->strings)
+    entry->value.string = NULL;
+  else
+    entry->value.number = 0;
+  return entry;
+}
+
+bool map_delete(HashMap *map, const char *key) {
+  if (!map->count)
+    return false;
+  size_t mask = map->slot_count - 1;
+  size_t hole = find_slot(map, key, key_hash(key));
+  uint32_t index = map->slots[hole];
+  if (index == UINT32_MAX)
+    return false;
+  entry_free(map, &map->entries[index]);
+
+  /* No tombstones: pull later entries of the cluster back into the hole
+   * unless that would put them before their home slot */
+  for (size_t next = (hole + 1) & mask; map->slots[next] != UINT32_MAX;
+       next = (next + 1) & mask) {
+    size_t home = (size_t)map->entries[map->slots[next]].hash & mask;
+    if (((next - home) & mask) >= ((next - hole) & mask)) {
+      map->slots[hole] = map->slots[next];
+      hole = next;
+    }
+  }
+  map->slots[hole] = UINT32_MAX;
+
+  /* Keep the entries dense: the last one takes the freed place */
+  uint32_t last = (uint32_t)(map->count - 1);
+  if (index != last) {
+    size_t slot = (size_t)map->entries[last].hash & mask;
+    while (map->slots[slot] != last)
+      slot = (slot + 1) & mask;
+    map->slots[slot] = index;
+    map->entries[index] = map->entries[last];
+  }
+  map->count--;
+  return true;
+}
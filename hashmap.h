@@ -0,0 +1,41 @@
+#ifndef HASHMAP_H
+#define HASHMAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* One key of a keyed collection (H{} or H${}) */
+typedef struct {
+  char *key;
+  uint64_t hash;
+  union {
+    double number;
+    char *string; // NULL reads as ""
+  } value;
+} MapEntry;
+
+/* String-keyed map: entries are kept dense, in insertion order until a
+ * delete moves the last entry into the gap, and an open-addressing table
+ * of entry indices (linear probing, UINT32_MAX when empty) finds them */
+typedef struct {
+  MapEntry *entries;
+  size_t count;
+  size_t capacity;
+  uint32_t *slots;
+  size_t slot_count; // Power of two, twice capacity
+  bool strings;      // Values are strings
+} HashMap;
+
+void map_init(HashMap *map, bool strings);
+void map_free(HashMap *map); // Releases every entry; the map stays usable
+
+/* Entry for key, or NULL if there is none */
+MapEntry *map_find(const HashMap *map, const char *key);
+/* Entry for key, added with a zero / empty value if new; NULL when memory
+ * runs out. The pointer is valid until the next insert or delete. */
+MapEntry *map_insert(HashMap *map, const char *key);
+/* Remove key; false if it was not there */
+bool map_delete(HashMap *map, const char *key);
+
+#endif /* HASHMAP_H */
@@ -1,9 +1,16 @@
 #define _GNU_SOURCE
 #include "interpreter.h"
+#include "compile.h"
 #include "editor.h"
 #include "lexer.h"
+#include "matrix.h"
+#include "memmap.h"
+#include "numfmt.h"
+#include "snapshot.h"
+#include "sort.h"
 #include "utils.h"
 #include <ctype.h>
+#include <limits.h>
 #include <math.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -11,17 +18,28 @@
 #include <string.h>
 #include <time.h>
 
+static void basic_write(Interpreter *interp, const char *str, size_t len) {
+  if (interp->editor) {
+    // Pending POKEs go out first so they don't overwrite newer text
+    mem_sync_screen(interp);
+    editor_print(interp->editor, str);
+  } else if (interp->headless) {
+    // stdout is fully buffered; flushed when the buffer fills, before
+    // waiting on stdin, and on exit
+    fwrite(str, 1, len, stdout);
+  } else {
+    fwrite(str, 1, len, stdout);
+    fflush(stdout);
+  }
+}
+
 static void basic_print(Interpreter *interp, const char *format, ...) {
   va_list args;
   va_start(args, format);
   char *buf = NULL;
-  if (vasprintf(&buf, format, args) != -1) {
-    if (interp->editor) {
-      editor_print(interp->editor, buf);
-    } else {
-      printf("%s", buf);
-      fflush(stdout);
-    }
+  int len = vasprintf(&buf, format, args);
+  if (len != -1) {
+    basic_write(interp, buf, (size_t)len);
     free(buf);
   }
   va_end(args);
@@ -35,9 +53,19 @@ static void interpreter_error(Interpreter *interp, const char *msg) {
   interp->error_message = str_duplicate(msg);
 }
 
+/* Seed for RND when none is given, and for RND(0): the time, plus the
+ * interpreter's address so interpreters started together differ */
+static uint64_t clock_seed(Interpreter *interp) {
+  return ((uint64_t)time(NULL) << 20) ^ (uint64_t)clock() ^
+         (uint64_t)(uintptr_t)interp;
+}
+
 void interpreter_init(Interpreter *interp) {
-  interp->program = NULL;
+  memset(&interp->program, 0, sizeof(interp->program));
   interp->current_line = NULL;
+  interp->jumped = false;
+  data_init(&interp->data);
+  memset(interp->channels, 0, sizeof(interp->channels));
   interp->variables = NULL;
   interp->call_stack = NULL;
   interp->for_stack = NULL;
@@ -46,17 +74,25 @@ void interpreter_init(Interpreter *interp) {
   interp->break_requested = false;
   interp->exit_requested = false;
   interp->error_occurred = false;
+  interp->headless = false;
+  interp->batch_input = false;
+  interp->input_eof = false;
   interp->graphics_x = 0;
   interp->graphics_y = 0;
-  memset(interp->ram, 0, sizeof(interp->ram));
+  gfx_clear(&interp->bitmap);
+  memset(interp->ram_store, 0, sizeof(interp->ram_store));
+  interp->ram = interp->ram_store;
+  interp->ram_mapped = false;
+  mem_init(interp);
   interp->error_message = NULL;
-
-  /* Seed random number generator */
-  srand(time(NULL));
+  rng_seed(&interp->rng, clock_seed(interp));
 }
 
 void interpreter_free(Interpreter *interp) {
   program_clear(interp);
+  data_clear(&interp->data);
+  chan_close_all(interp->channels);
+  mem_unmap_image(interp);
   var_clear_all(interp);
 
   while (interp->call_stack) {
@@ -72,89 +108,244 @@ void interpreter_free(Interpreter *interp) {
   }
 }
 
-/* Program line management */
-void program_add_line(Interpreter *interp, int line_num, const char *text) {
-  /* Delete existing line with same number */
-  program_delete_line(interp, line_num);
+/* Program line management. Lines are kept sorted by number in one array
+ * and their text and code in one arena, so RUN walks memory in order and
+ * NEW frees two blocks. ProgramLine pointers stay valid until the program
+ * is next edited, which only happens outside RUN. */
+#define NO_TEXT UINT32_MAX
+
+static bool program_reserve_lines(Program *prog, int count) {
+  if (count <= prog->capacity)
+    return true;
+  int capacity = prog->capacity ? prog->capacity * 2 : 64;
+  if (capacity < count)
+    capacity = count;
+  /* Near the memory limit, grow only as far as needed */
+  if ((size_t)(capacity - prog->capacity) * sizeof(ProgramLine) >
+      get_free_memory())
+    capacity = count;
+  ProgramLine *lines =
+      safe_realloc(prog->lines, prog->capacity * sizeof(ProgramLine),
+                   capacity * sizeof(ProgramLine));
+  if (!lines)
+    return false;
+  prog->lines = lines;
+  prog->capacity = capacity;
+  return true;
+}
 
-  /* If text is empty, just delete the line */
-  if (!text || strlen(text) == 0) {
-    return;
+/* Append bytes to the arena; returns their offset or NO_TEXT */
+static uint32_t arena_append(Program *prog, const void *data, size_t len) {
+  size_t need = prog->arena_used + len;
+  if (need >= NO_TEXT)
+    return NO_TEXT;
+  if (need > prog->arena_size) {
+    size_t size = prog->arena_size ? prog->arena_size * 2 : 1024;
+    if (size < need)
+      size = need;
+    if (size - prog->arena_size > get_free_memory())
+      size = need;
+    uint8_t *arena = safe_realloc(prog->arena, prog->arena_size, size);
+    if (!arena)
+      return NO_TEXT;
+    prog->arena = arena;
+    prog->arena_size = size;
   }
+  uint32_t offset = (uint32_t)prog->arena_used;
+  memcpy(prog->arena + offset, data, len);
+  prog->arena_used = need;
+  return offset;
+}
 
-  /* Create new line */
-  ProgramLine *new_line = safe_malloc(sizeof(ProgramLine));
-  new_line->line_number = line_num;
-  new_line->text = str_duplicate(text);
-  new_line->next = NULL;
+static size_t line_arena_bytes(Program *prog, ProgramLine *line) {
+  size_t bytes = line->code_len;
+  if (line->text != NO_TEXT)
+    bytes += strlen((const char *)prog->arena + line->text) + 1;
+  return bytes;
+}
 
-  /* Insert in sorted order */
-  if (!interp->program || interp->program->line_number > line_num) {
-    new_line->next = interp->program;
-    interp->program = new_line;
-  } else {
-    ProgramLine *current = interp->program;
-    while (current->next && current->next->line_number < line_num) {
-      current = current->next;
+/* Copy live text and code into a fresh arena in line order, dropping
+ * what deleted and replaced lines left behind */
+static void program_compact(Program *prog) {
+  size_t live = prog->arena_used - prog->arena_garbage;
+  if (live + sizeof(size_t) > get_free_memory())
+    return;
+  Program fresh = {0};
+  fresh.arena = safe_malloc(live ? live : 1);
+  if (!fresh.arena)
+    return;
+  fresh.arena_size = live ? live : 1;
+
+  for (int i = 0; i < prog->count; i++) {
+    ProgramLine *line = &prog->lines[i];
+    if (line->text != NO_TEXT) {
+      const char *text = (const char *)prog->arena + line->text;
+      line->text = arena_append(&fresh, text, strlen(text) + 1);
     }
-    new_line->next = current->next;
-    current->next = new_line;
+    line->code = arena_append(&fresh, prog->arena + line->code,
+                              line->code_len);
   }
+  safe_free(prog->arena);
+  prog->arena = fresh.arena;
+  prog->arena_size = fresh.arena_size;
+  prog->arena_used = fresh.arena_used;
+  prog->arena_garbage = 0;
 }
 
-void program_delete_line(Interpreter *interp, int line_num) {
-  if (!interp->program)
-    return;
+static void program_discard_line(Program *prog, ProgramLine *line) {
+  prog->arena_garbage += line_arena_bytes(prog, line);
+}
 
-  if (interp->program->line_number == line_num) {
-    ProgramLine *temp = interp->program;
-    interp->program = interp->program->next;
-    safe_free(temp->text);
-    safe_free(temp);
-    return;
+static void program_maybe_compact(Program *prog) {
+  if (prog->arena_garbage > 4096 &&
+      prog->arena_garbage > prog->arena_used / 2)
+    program_compact(prog);
+}
+
+/* Index of the first line numbered >= line_num */
+static int program_lower_bound(Program *prog, int line_num) {
+  int lo = 0, hi = prog->count;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (prog->lines[mid].line_number < line_num)
+      lo = mid + 1;
+    else
+      hi = mid;
   }
+  return lo;
+}
 
-  ProgramLine *current = interp->program;
-  while (current->next) {
-    if (current->next->line_number == line_num) {
-      ProgramLine *temp = current->next;
-      current->next = temp->next;
-      safe_free(temp->text);
-      safe_free(temp);
-      return;
-    }
-    current = current->next;
+/* Add or replace a line. `text` may be NULL for lines loaded pre-tokenized;
+ * `code` may be NULL to tokenize `text`. Lines arriving in ascending order
+ * (the normal case when loading) are appended without a search. */
+static bool program_store_line(Interpreter *interp, int line_num,
+                               const char *text, size_t text_len,
+                               const uint8_t *code, size_t code_len) {
+  Program *prog = &interp->program;
+  uint8_t *tokens = NULL;
+  data_clear(&interp->data);
+  prog->compiled = false;
+  if (!code) {
+    char *line = safe_malloc(text_len + 1);
+    if (!line)
+      return false;
+    memcpy(line, text, text_len);
+    line[text_len] = '\0';
+    /* Tokenize once on entry so RUN never rescans source text */
+    tokens = lexer_tokenize(line, &code_len);
+    safe_free(line);
+    if (!tokens)
+      return false;
+    code = tokens;
+  }
+
+  ProgramLine entry = {line_num, NO_TEXT, NO_TEXT, (uint32_t)code_len};
+  if (text) {
+    entry.text = arena_append(prog, text, text_len);
+    if (arena_append(prog, "", 1) == NO_TEXT)
+      entry.text = NO_TEXT;
+  }
+  entry.code = arena_append(prog, code, code_len);
+  safe_free(tokens);
+  if ((text && entry.text == NO_TEXT) || entry.code == NO_TEXT) {
+    prog->arena_garbage += line_arena_bytes(prog, &entry) - code_len;
+    return false;
+  }
+
+  int index = prog->count;
+  if (prog->count && prog->lines[prog->count - 1].line_number >= line_num)
+    index = program_lower_bound(prog, line_num);
+
+  if (index < prog->count && prog->lines[index].line_number == line_num) {
+    program_discard_line(prog, &prog->lines[index]);
+    prog->lines[index] = entry;
+    program_maybe_compact(prog);
+    return true;
   }
+
+  if (!program_reserve_lines(prog, prog->count + 1))
+    return false;
+  memmove(&prog->lines[index + 1], &prog->lines[index],
+          (prog->count - index) * sizeof(ProgramLine));
+  prog->lines[index] = entry;
+  prog->count++;
+  return true;
 }
 
-ProgramLine *program_find_line(Interpreter *interp, int line_num) {
-  ProgramLine *current = interp->program;
-  while (current) {
-    if (current->line_number == line_num) {
-      return current;
-    }
-    if (current->line_number > line_num) {
-      return NULL;
-    }
-    current = current->next;
+/* Source text of a line, rebuilt from its code on first use */
+static const char *program_line_text(Interpreter *interp, ProgramLine *line) {
+  Program *prog = &interp->program;
+  if (line->text == NO_TEXT) {
+    char *text = lexer_detokenize(prog->arena + line->code);
+    if (!text)
+      return "";
+    line->text = arena_append(prog, text, strlen(text) + 1);
+    safe_free(text);
+    if (line->text == NO_TEXT)
+      return "";
+  }
+  return (const char *)prog->arena + line->text;
+}
+
+const uint8_t *program_line_code(Interpreter *interp, ProgramLine *line) {
+  return interp->program.arena + line->code;
+}
+
+void program_add_line(Interpreter *interp, int line_num, const char *text) {
+  /* If text is empty, just delete the line */
+  if (!text || strlen(text) == 0) {
+    program_delete_line(interp, line_num);
+    return;
   }
+
+  program_store_line(interp, line_num, text, strlen(text), NULL, 0);
+}
+
+void program_delete_line(Interpreter *interp, int line_num) {
+  ProgramLine *line = program_find_line(interp, line_num);
+  if (!line)
+    return;
+
+  Program *prog = &interp->program;
+  int index = (int)(line - prog->lines);
+  data_clear(&interp->data);
+  prog->compiled = false;
+  program_discard_line(prog, line);
+  memmove(line, line + 1, (prog->count - index - 1) * sizeof(ProgramLine));
+  prog->count--;
+  program_maybe_compact(prog);
+}
+
+ProgramLine *program_find_line(Interpreter *interp, int line_num) {
+  Program *prog = &interp->program;
+  int index = program_lower_bound(prog, line_num);
+  if (index < prog->count && prog->lines[index].line_number == line_num)
+    return &prog->lines[index];
   return NULL;
 }
 
+/* The line after `line` in program order, or NULL at the end */
+ProgramLine *program_next_line(Interpreter *interp, ProgramLine *line) {
+  Program *prog = &interp->program;
+  return line + 1 < prog->lines + prog->count ? line + 1 : NULL;
+}
+
 void program_clear(Interpreter *interp) {
-  while (interp->program) {
-    ProgramLine *temp = interp->program;
-    interp->program = interp->program->next;
-    safe_free(temp->text);
-    safe_free(temp);
-  }
+  Program *prog = &interp->program;
+  data_clear(&interp->data);
+  safe_free(prog->lines);
+  safe_free(prog->arena);
+  memset(prog, 0, sizeof(*prog));
+  interp->current_line = NULL;
 }
 
 /* Variable management */
 Variable *var_get(Interpreter *interp, const char *name) {
   Variable *current = interp->variables;
   while (current) {
-    if (str_compare_nocase(current->name, name) == 0) {
+    if ((current->type == VAR_NUMBER || current->type == VAR_STRING ||
+         current->type == VAR_INTEGER) &&
+        str_compare_nocase(current->name, name) == 0) {
       return current;
     }
     current = current->next;
@@ -205,6 +396,23 @@ Variable *var_set_string(Interpreter *interp, const char *name,
   return var;
 }
 
+Variable *var_set_integer(Interpreter *interp, const char *name,
+                          int32_t value) {
+  Variable *var = var_get(interp, name);
+
+  if (!var) {
+    var = safe_malloc(sizeof(Variable));
+    var->name = str_duplicate(name);
+    var->next = interp->variables;
+    interp->variables = var;
+  } else if (var->type == VAR_STRING && var->value.string) {
+    safe_free(var->value.string);
+  }
+  var->type = VAR_INTEGER;
+  var->value.integer = value;
+  return var;
+}
+
 void var_clear_all(Interpreter *interp) {
   while (interp->variables) {
     Variable *temp = interp->variables;
@@ -212,12 +420,117 @@ void var_clear_all(Interpreter *interp) {
 
     if (temp->type == VAR_STRING && temp->value.string) {
       safe_free(temp->value.string);
+    } else if (temp->type == VAR_ARRAY_NUMBER ||
+               temp->type == VAR_ARRAY_STRING ||
+               temp->type == VAR_ARRAY_INTEGER) {
+      if (temp->type == VAR_ARRAY_STRING) {
+        char **strings = temp->value.array.data;
+        for (size_t i = 0; i < temp->value.array.count; i++)
+          safe_free(strings[i]);
+      }
+      safe_free(temp->value.array.data);
+      safe_free(temp->value.array.dimensions);
+    } else if (temp->type == VAR_MAP_NUMBER || temp->type == VAR_MAP_STRING) {
+      map_free(&temp->value.map);
     }
     safe_free(temp->name);
     safe_free(temp);
   }
 }
 
+Variable *array_get(Interpreter *interp, const char *name) {
+  for (Variable *v = interp->variables; v; v = v->next) {
+    if ((v->type == VAR_ARRAY_NUMBER || v->type == VAR_ARRAY_STRING ||
+         v->type == VAR_ARRAY_INTEGER) &&
+        str_compare_nocase(v->name, name) == 0)
+      return v;
+  }
+  return NULL;
+}
+
+Variable *array_create(Interpreter *interp, const char *name,
+                       const int *dimensions, int dim_count) {
+  char suffix = name[strlen(name) - 1];
+  size_t elem_size = suffix == '$'   ? sizeof(char *)
+                     : suffix == '%' ? sizeof(int32_t)
+                                     : sizeof(double);
+  size_t count = 1;
+  for (int i = 0; i < dim_count; i++) {
+    if (dimensions[i] <= 0) {
+      interpreter_error(interp, "ILLEGAL QUANTITY");
+      return NULL;
+    }
+    if ((size_t)dimensions[i] > INT_MAX / count ||
+        count * (size_t)dimensions[i] > SIZE_MAX / elem_size) {
+      interpreter_error(interp, "OUT OF MEMORY");
+      return NULL;
+    }
+    count *= (size_t)dimensions[i];
+  }
+
+  /* One block of elements plus one for the extents and strides */
+  Variable *var = safe_malloc(sizeof(Variable));
+  int *shape = safe_malloc(2 * (size_t)dim_count * sizeof(int));
+  void *data = safe_malloc(count * elem_size);
+  char *copy = str_duplicate(name);
+  if (!var || !shape || !data || !copy) {
+    safe_free(var);
+    safe_free(shape);
+    safe_free(data);
+    safe_free(copy);
+    interpreter_error(interp, "OUT OF MEMORY");
+    return NULL;
+  }
+  memset(data, 0, count * elem_size);
+
+  int stride = 1;
+  for (int i = dim_count - 1; i >= 0; i--) {
+    shape[i] = dimensions[i];
+    shape[dim_count + i] = stride;
+    stride *= dimensions[i];
+  }
+  var->name = copy;
+  var->type = suffix == '$'   ? VAR_ARRAY_STRING
+              : suffix == '%' ? VAR_ARRAY_INTEGER
+                              : VAR_ARRAY_NUMBER;
+  var->value.array.data = data;
+  var->value.array.dimensions = shape;
+  var->value.array.strides = shape + dim_count;
+  var->value.array.dim_count = dim_count;
+  var->value.array.count = count;
+  var->value.array.sorted = 0;
+  var->next = interp->variables;
+  interp->variables = var;
+  return var;
+}
+
+Variable *map_get(Interpreter *interp, const char *name) {
+  for (Variable *v = interp->variables; v; v = v->next) {
+    if ((v->type == VAR_MAP_NUMBER || v->type == VAR_MAP_STRING) &&
+        str_compare_nocase(v->name, name) == 0)
+      return v;
+  }
+  return NULL;
+}
+
+Variable *map_create(Interpreter *interp, const char *name) {
+  bool is_string = name[strlen(name) - 1] == '$';
+  Variable *var = safe_malloc(sizeof(Variable));
+  char *copy = str_duplicate(name);
+  if (!var || !copy) {
+    safe_free(var);
+    safe_free(copy);
+    interpreter_error(interp, "OUT OF MEMORY");
+    return NULL;
+  }
+  var->name = copy;
+  var->type = is_string ? VAR_MAP_STRING : VAR_MAP_NUMBER;
+  map_init(&var->value.map, is_string);
+  var->next = interp->variables;
+  interp->variables = var;
+  return var;
+}
+
 /* Stack management for GOSUB/RETURN */
 void stack_push(Interpreter *interp, int return_line) {
   StackFrame *frame = safe_malloc(sizeof(StackFrame));
@@ -275,19 +588,20 @@ void for_pop(Interpreter *interp) {
 
 /* Interpreter commands */
 void interpreter_list(Interpreter *interp, int start, int end) {
-  ProgramLine *current = interp->program;
+  Program *prog = &interp->program;
 
-  while (current) {
-    if (current->line_number >= start &&
-        (end == -1 || current->line_number <= end)) {
-      basic_print(interp, "%d %s\n", current->line_number, current->text);
-    }
-    current = current->next;
+  for (int i = program_lower_bound(prog, start); i < prog->count; i++) {
+    ProgramLine *current = &prog->lines[i];
+    if (end != -1 && current->line_number > end)
+      break;
+    basic_print(interp, "%d %s\n", current->line_number,
+                program_line_text(interp, current));
   }
 }
 
 void interpreter_new(Interpreter *interp) {
   program_clear(interp);
+  chan_close_all(interp->channels);
   var_clear_all(interp);
 
   while (interp->call_stack) {
@@ -299,35 +613,126 @@ void interpreter_new(Interpreter *interp) {
   }
 }
 
-bool interpreter_load(Interpreter *interp, const char *filename) {
-  FILE *file = fopen(filename, "r");
-  if (!file) {
-    interpreter_error(interp, "FILE NOT FOUND");
-    return false;
+/* Parse "<number> <text>" lines from a source image. A line number above
+ * MAX_LINE_NUMBER stops the load with an error naming the file line. */
+static bool program_parse_source(Interpreter *interp, const char *src,
+                                 size_t size) {
+  const char *p = src;
+  const char *end = src + size;
+  int source_line = 0;
+
+  while (p < end) {
+    source_line++;
+    const char *eol = memchr(p, '\n', (size_t)(end - p));
+    if (!eol)
+      eol = end;
+    const char *next = eol < end ? eol + 1 : end;
+    if (eol > p && eol[-1] == '\r')
+      eol--;
+
+    while (p < eol && (*p == ' ' || *p == '\t'))
+      p++;
+    if (p == eol || *p < '0' || *p > '9') {
+      p = next;
+      continue;
+    }
+
+    int line_num = 0;
+    while (p < eol && *p >= '0' && *p <= '9' && line_num <= MAX_LINE_NUMBER) {
+      line_num = line_num * 10 + (*p - '0');
+      p++;
+    }
+    if (line_num > MAX_LINE_NUMBER) {
+      char msg[48];
+      snprintf(msg, sizeof(msg), "BAD LINE NUMBER IN LINE %d", source_line);
+      interpreter_error(interp, msg);
+      return false;
+    }
+    while (p < eol && (*p == ' ' || *p == '\t'))
+      p++;
+
+    if (p < eol &&
+        !program_store_line(interp, line_num, p, (size_t)(eol - p), NULL, 0)) {
+      interpreter_error(interp, "OUT OF MEMORY");
+      return false;
+    }
+    p = next;
   }
+  return true;
+}
 
-  interpreter_new(interp);
+/* Pre-tokenized program image: a header, then one record per line of
+ * u32 offset of the next record (0 ends the program), u32 line number and
+ * the line's code. The check value rejects images from hosts with a
+ * different double layout, since numbers are stored in native form. */
+#define BINARY_MAGIC "CFB\x1a"
+#define BINARY_HEADER_SIZE (4 + 1 + sizeof(double) + 4)
+#define BINARY_CHECK 1.0
+
+bool interpreter_is_binary(const void *src, size_t size) {
+  return size >= BINARY_HEADER_SIZE && memcmp(src, BINARY_MAGIC, 4) == 0;
+}
+
+static bool program_parse_binary(Interpreter *interp, const uint8_t *src,
+                                 size_t size) {
+  double check;
+  memcpy(&check, src + 5, sizeof(check));
+  if (src[4] != BINARY_VERSION || check != BINARY_CHECK ||
+      get_u32(src + 5 + sizeof(check)) != lexer_code_version()) {
+    interpreter_error(interp, "BAD FILE FORMAT");
+    return false;
+  }
 
-  char line[1024];
-  while (fgets(line, sizeof(line), file)) {
-    /* Remove newline */
-    size_t len = strlen(line);
-    if (len > 0 && line[len - 1] == '\n') {
-      line[len - 1] = '\0';
+  size_t pos = BINARY_HEADER_SIZE;
+  while (pos + 8 < size) {
+    uint32_t next = get_u32(src + pos);
+    uint32_t line_num = get_u32(src + pos + 4);
+    size_t code_end = next ? next : size;
+    if (code_end <= pos + 8 || code_end > size ||
+        line_num > MAX_LINE_NUMBER ||
+        !lexer_code_valid(src + pos + 8, code_end - pos - 8)) {
+      interpreter_error(interp, "BAD FILE FORMAT");
+      return false;
     }
 
-    /* Parse line number */
-    int line_num;
-    char text[1024];
-    if (sscanf(line, "%d %[^\n]", &line_num, text) == 2) {
-      program_add_line(interp, line_num, text);
+    if (!program_store_line(interp, (int)line_num, NULL, 0, src + pos + 8,
+                            code_end - pos - 8)) {
+      interpreter_error(interp, "OUT OF MEMORY");
+      return false;
     }
-  }
 
-  fclose(file);
+    if (!next)
+      break;
+    pos = next;
+  }
   return true;
 }
 
+bool interpreter_load_image(Interpreter *interp, const void *src,
+                           size_t size) {
+  interpreter_new(interp);
+  bool ok = interpreter_is_binary(src, size)
+                ? program_parse_binary(interp, src, size)
+                : program_parse_source(interp, src, size);
+  /* Never leave half a program behind */
+  if (!ok)
+    program_clear(interp);
+  return ok;
+}
+
+bool interpreter_load(Interpreter *interp, const char *filename) {
+  size_t size;
+  const void *src = file_map(filename, &size);
+  if (!src) {
+    interpreter_error(interp, "FILE NOT FOUND");
+    return false;
+  }
+
+  bool ok = interpreter_load_image(interp, src, size);
+  file_unmap(src, size);
+  return ok;
+}
+
 bool interpreter_save(Interpreter *interp, const char *filename) {
   FILE *file = fopen(filename, "w");
   if (!file) {
@@ -335,25 +740,112 @@ bool interpreter_save(Interpreter *interp, const char *filename) {
     return false;
   }
 
-  ProgramLine *current = interp->program;
-  while (current) {
-    fprintf(file, "%d %s\n", current->line_number, current->text);
-    current = current->next;
+  Program *prog = &interp->program;
+  for (int i = 0; i < prog->count; i++) {
+    ProgramLine *current = &prog->lines[i];
+    fprintf(file, "%d %s\n", current->line_number,
+            program_line_text(interp, current));
   }
 
   fclose(file);
   return true;
 }
 
-void interpreter_run(Interpreter *interp) {
-  if (!interp->program) {
-    return;
+bool interpreter_save_binary(Interpreter *interp, const char *filename) {
+  FILE *file = fopen(filename, "wb");
+  if (!file) {
+    interpreter_error(interp, "CANNOT SAVE FILE");
+    return false;
+  }
+
+  bool ok = interpreter_write_binary(interp, file);
+  if (fclose(file) != 0 || !ok) {
+    interpreter_error(interp, "CANNOT SAVE FILE");
+    return false;
+  }
+  return true;
+}
+
+bool interpreter_write_binary(Interpreter *interp, FILE *file) {
+  uint8_t header[BINARY_HEADER_SIZE];
+  double check = BINARY_CHECK;
+  memcpy(header, BINARY_MAGIC, 4);
+  header[4] = BINARY_VERSION;
+  memcpy(header + 5, &check, sizeof(check));
+  put_u32(header + 5 + sizeof(check), lexer_code_version());
+  fwrite(header, 1, sizeof(header), file);
+
+  size_t offset = sizeof(header);
+  Program *prog = &interp->program;
+  for (int i = 0; i < prog->count; i++) {
+    ProgramLine *current = &prog->lines[i];
+    uint8_t record[8];
+    offset += sizeof(record) + current->code_len;
+    put_u32(record, i + 1 < prog->count ? (uint32_t)offset : 0);
+    put_u32(record + 4, (uint32_t)current->line_number);
+    fwrite(record, 1, sizeof(record), file);
+    fwrite(program_line_code(interp, current), 1, current->code_len, file);
+  }
+  return !ferror(file);
+}
+
+/* Display sync for batched screen RAM writes: the clock is checked every
+ * SYNC_CHECK_LINES lines and the screen redrawn at most every
+ * SYNC_INTERVAL (a 50Hz PAL frame) */
+#define SYNC_CHECK_LINES 256
+#define SYNC_INTERVAL (CLOCKS_PER_SEC / 50)
+
+static void report_error(Interpreter *interp, ProgramLine *line) {
+  if (interp->error_message) {
+    basic_print(interp, "?%s ERROR IN %d\n", interp->error_message,
+                line->line_number);
+    safe_free(interp->error_message);
+    interp->error_message = NULL;
+  } else {
+    basic_print(interp, "?ERROR IN %d\n", line->line_number);
   }
+  interp->error_occurred = false;
+}
+
+/* Type every line once after each edit, before any of it runs, so type
+ * mismatches anywhere in the program stop RUN at the start */
+static bool program_compile(Interpreter *interp) {
+  Program *prog = &interp->program;
+  if (prog->compiled)
+    return true;
+  for (int i = 0; i < prog->count; i++) {
+    ProgramLine *line = &prog->lines[i];
+    if (!compile_code(prog->arena + line->code)) {
+      interpreter_error(interp, "TYPE MISMATCH");
+      report_error(interp, line);
+      return false;
+    }
+  }
+  prog->compiled = true;
+  return true;
+}
 
+/* Execute from `line`, starting `offset` bytes into its code */
+static void run_from(Interpreter *interp, ProgramLine *line, size_t offset) {
+  if (!program_compile(interp))
+    return;
   interp->running = true;
-  interp->current_line = interp->program;
+  interp->current_line = line;
+
+  /* Screen RAM POKEs reach the terminal once per frame, not per POKE */
+  unsigned int lines_since_check = 0;
+  clock_t last_sync = clock();
 
   while (interp->running && interp->current_line) {
+    if (interp->screen_pending && ++lines_since_check >= SYNC_CHECK_LINES) {
+      lines_since_check = 0;
+      clock_t now = clock();
+      if (now - last_sync >= SYNC_INTERVAL) {
+        mem_sync_screen(interp);
+        last_sync = now;
+      }
+    }
+
     if (interp->break_requested) {
       basic_print(interp, "\n? BREAK\n");
       interp->break_requested = false;
@@ -362,50 +854,221 @@ void interpreter_run(Interpreter *interp) {
     }
 
     ProgramLine *executing_line = interp->current_line;
-    interpreter_execute_line(interp, executing_line->text);
+    interp->jumped = false;
+    interpreter_execute_code(interp,
+                             program_line_code(interp, executing_line) + offset);
+    offset = 0;
 
     if (interp->error_occurred) {
-      if (interp->error_message) {
-        basic_print(interp, "?%s ERROR IN %d\n", interp->error_message,
-                    executing_line->line_number);
-        safe_free(interp->error_message);
-        interp->error_message = NULL;
-      } else {
-        basic_print(interp, "?ERROR IN %d\n", executing_line->line_number);
-      }
+      report_error(interp, executing_line);
       interp->running = false;
-      interp->error_occurred = false;
       break;
     }
 
-    /* Advance if execution didn't change current_line */
-    if (interp->running && interp->current_line == executing_line) {
-      interp->current_line = executing_line->next;
+    /* Advance unless the line jumped (possibly to itself) */
+    if (interp->running && !interp->jumped) {
+      interp->current_line = program_next_line(interp, executing_line);
     }
   }
 
+  mem_sync_screen(interp);
   interp->running = false;
 }
 
-/* Very basic value structure for expressions */
+void interpreter_run(Interpreter *interp) {
+  if (!interp->program.count) {
+    return;
+  }
+
+  /* RUN starts from a clean slate, as on the C64, so DIMs can run again */
+  var_clear_all(interp);
+  while (interp->call_stack)
+    stack_pop(interp);
+  while (interp->for_stack)
+    for_pop(interp);
+  data_clear(&interp->data);
+  chan_close_all(interp->channels);
+  interp->input_eof = false;
+  run_from(interp, interp->program.lines, 0);
+}
+
+void interpreter_resume(Interpreter *interp, int line_number, size_t offset) {
+  ProgramLine *line = program_find_line(interp, line_number);
+  if (line && offset < line->code_len)
+    run_from(interp, line, offset);
+}
+
+/* Very basic value structure for expressions. Integers (% variables,
+ * whole literals, and integer results that fit) are carried in `integer`
+ * with is_integer set; evaluate_expression fills in `number` as well. */
 typedef struct {
   bool is_string;
   double number;
   char *string;
+  bool is_integer;
+  int32_t integer;
 } Value;
 
 Value evaluate_expression(Interpreter *interp, Lexer *lexer);
+static Variable *array_element(Interpreter *interp, Lexer *lexer,
+                               const char *name, size_t *index);
+static double search_function(Interpreter *interp, Lexer *lexer);
+static Variable *map_arg(Interpreter *interp, Lexer *lexer, char **key);
+static int parse_numbers(Interpreter *interp, Lexer *lexer, double *out,
+                         int min, int max);
+
+static bool next_is(Lexer *lexer, TokenType type) {
+  return lexer_peek_type(lexer) == type;
+}
+#define next_is_hash(lexer) next_is(lexer, TOK_HASH)
+#define next_is_comma(lexer) next_is(lexer, TOK_COMMA)
+
+/* Consume the next token, raising SYNTAX unless it has the given type */
+static bool expect_token(Interpreter *interp, Lexer *lexer, TokenType type) {
+  Token token = lexer_next_token(lexer);
+  bool ok = token.type == type;
+  token_free(&token);
+  if (!ok)
+    interpreter_error(interp, "SYNTAX");
+  return ok;
+}
+
+/* "H{}", a whole map, comes next */
+static bool next_is_whole_map(Lexer *lexer) {
+  int position = lexer->position;
+  int line = lexer->line;
+  int column = lexer->column;
+  Token name = lexer_next_token(lexer);
+  Token lbrace = lexer_next_token(lexer);
+  bool match = name.type == TOK_IDENTIFIER && lbrace.type == TOK_LBRACE &&
+               next_is(lexer, TOK_RBRACE);
+  token_free(&name);
+  token_free(&lbrace);
+  lexer->position = position;
+  lexer->line = line;
+  lexer->column = column;
+  return match;
+}
+
+/* "{key}" after a map name: *key is the key (owned), or NULL for "{}",
+ * the whole map. False after an error. */
+static bool map_key(Interpreter *interp, Lexer *lexer, char **key) {
+  *key = NULL;
+  if (!expect_token(interp, lexer, TOK_LBRACE))
+    return false;
+  if (next_is(lexer, TOK_RBRACE))
+    return expect_token(interp, lexer, TOK_RBRACE);
+  Value v = evaluate_expression(interp, lexer);
+  if (!v.is_string) {
+    if (!interp->error_occurred)
+      interpreter_error(interp, "TYPE MISMATCH");
+    return false;
+  }
+  if (interp->error_occurred || !expect_token(interp, lexer, TOK_RBRACE)) {
+    safe_free(v.string);
+    return false;
+  }
+  *key = v.string;
+  return true;
+}
+
+
+static void skip_token(Lexer *lexer) {
+  Token token = lexer_next_token(lexer);
+  token_free(&token);
+}
+
+static Value number_value(double n) {
+  Value v = {false, n, NULL, false, 0};
+  return v;
+}
+
+/* Whole results stay integers while they fit in 32 bits */
+static Value integer_value(int64_t n) {
+  if (n < INT32_MIN || n > INT32_MAX)
+    return number_value((double)n);
+  Value v = {false, 0, NULL, true, (int32_t)n};
+  return v;
+}
+
+static bool fits_integer(double n) {
+  return n >= INT32_MIN && n <= INT32_MAX && n == floor(n);
+}
+
+static double value_number(const Value *v) {
+  return v->is_integer ? (double)v->integer : v->number;
+}
+
+/* Check that `count` arguments lie in lo..hi before they are cast to
+ * integers; NaN and infinities fail too. */
+static bool in_range(Interpreter *interp, const double *v, int count,
+                     double lo, double hi) {
+  for (int i = 0; i < count; i++) {
+    if (!(v[i] >= lo && v[i] <= hi)) {
+      interpreter_error(interp, "ILLEGAL QUANTITY");
+      return false;
+    }
+  }
+  return true;
+}
+
+/* INT(n) as a 32-bit integer, for % variables and AND, OR and NOT */
+static bool to_integer(Interpreter *interp, double n, int32_t *out) {
+  n = floor(n);
+  if (!(n >= INT32_MIN && n <= INT32_MAX)) {
+    interpreter_error(interp, "ILLEGAL QUANTITY");
+    return false;
+  }
+  *out = (int32_t)n;
+  return true;
+}
+
+static bool value_integer(Interpreter *interp, const Value *v, int32_t *out) {
+  if (!v->is_integer)
+    return to_integer(interp, v->number, out);
+  *out = v->integer;
+  return true;
+}
 
 Value evaluate_factor(Interpreter *interp, Lexer *lexer) {
   Token token = lexer_next_token(lexer);
-  Value val = {false, 0, NULL};
+  Value val = {false, 0, NULL, false, 0};
 
   if (token.type == TOK_NUMBER) {
-    val.is_string = false;
-    val.number = token.number_value;
+    double n = token.number_value;
+    val = fits_integer(n) ? integer_value((int64_t)n) : number_value(n);
   } else if (token.type == TOK_STRING) {
     val.is_string = true;
     val.string = str_duplicate(token.text);
+  } else if (token.type == TOK_IDENTIFIER && next_is(lexer, TOK_LPAREN)) {
+    size_t index;
+    Variable *arr = array_element(interp, lexer, token.text, &index);
+    if (arr && arr->type == VAR_ARRAY_STRING) {
+      char *elem = ((char **)arr->value.array.data)[index];
+      val.is_string = true;
+      val.string = str_duplicate(elem ? elem : "");
+    } else if (arr && arr->type == VAR_ARRAY_INTEGER) {
+      val = integer_value(((int32_t *)arr->value.array.data)[index]);
+    } else if (arr) {
+      val.number = ((double *)arr->value.array.data)[index];
+    }
+  } else if (token.type == TOK_IDENTIFIER && next_is(lexer, TOK_LBRACE)) {
+    char *key;
+    if (map_key(interp, lexer, &key) && !key) {
+      interpreter_error(interp, "SYNTAX");
+    } else if (key) {
+      Variable *map = map_get(interp, token.text);
+      MapEntry *entry = map ? map_find(&map->value.map, key) : NULL;
+      if (token.text[strlen(token.text) - 1] == '$') {
+        val.is_string = true;
+        val.string = str_duplicate(entry && entry->value.string
+                                       ? entry->value.string
+                                       : "");
+      } else if (entry) {
+        val.number = entry->value.number;
+      }
+      safe_free(key);
+    }
   } else if (token.type == TOK_IDENTIFIER) {
     Variable *v = var_get(interp, token.text);
     if (v) {
@@ -415,12 +1078,16 @@ Value evaluate_factor(Interpreter *interp, Lexer *lexer) {
       } else if (v->type == VAR_STRING) {
         val.is_string = true;
         val.string = str_duplicate(v->value.string);
+      } else if (v->type == VAR_INTEGER) {
+        val = integer_value(v->value.integer);
       }
     } else {
       // Default to 0 or empty string if not found
       if (token.text && token.text[strlen(token.text) - 1] == '$') {
         val.is_string = true;
         val.string = str_duplicate("");
+      } else if (token.text[strlen(token.text) - 1] == '%') {
+        val = integer_value(0);
       } else {
         val.is_string = false;
         val.number = 0;
@@ -445,7 +1112,7 @@ Value evaluate_factor(Interpreter *interp, Lexer *lexer) {
     val.string = str_duplicate(buf);
     if (v.is_string)
       safe_free(v.string);
-  } else if (token.type == TOK_PEEK) {
+  } else if (token.type == TOK_STR) {
     token_free(&token);
     Token lparen = lexer_next_token(lexer);
     token_free(&lparen);
@@ -453,135 +1120,1580 @@ Value evaluate_factor(Interpreter *interp, Lexer *lexer) {
     Token rparen = lexer_next_token(lexer);
     token_free(&rparen);
 
-    val.is_string = false;
-    uint16_t addr = (uint16_t)v.number;
-    val.number = interp->ram[addr];
+    char num[NUMBER_BUF_SIZE];
+    format_number(num, v.is_string ? 0 : v.number);
+    val.is_string = true;
+    val.string = str_duplicate(num);
     if (v.is_string)
       safe_free(v.string);
-  }
-
-  token_free(&token);
-  return val;
-}
-
-Value evaluate_expression(Interpreter *interp, Lexer *lexer) {
-  /* Simplified: handles addition/concatenation and comparisons */
-  Value left = evaluate_factor(interp, lexer);
-
-  while (true) {
-    Token peek = lexer_peek_token(lexer);
-    if (peek.type == TOK_PLUS) {
-      lexer_next_token(lexer); // consume +
-      Value right = evaluate_factor(interp, lexer);
-      if (left.is_string && right.is_string) {
-        char *new_str =
-            safe_malloc(strlen(left.string) + strlen(right.string) + 1);
-        strcpy(new_str, left.string);
-        strcat(new_str, right.string);
-        safe_free(left.string);
-        safe_free(right.string);
-        left.string = new_str;
-      } else if (!left.is_string && !right.is_string) {
-        left.number += right.number;
-      }
-      token_free(&peek);
-    } else if (peek.type == TOK_EQUAL || peek.type == TOK_NOT_EQUAL ||
-               peek.type == TOK_LESS || peek.type == TOK_GREATER ||
-               peek.type == TOK_LESS_EQUAL || peek.type == TOK_GREATER_EQUAL) {
-      lexer_next_token(lexer); // consume operator
-      Value right = evaluate_factor(interp, lexer);
-      double res = 0;
-
-      if (left.is_string && right.is_string) {
-        int cmp = strcmp(left.string, right.string);
-        if (peek.type == TOK_EQUAL)
-          res = (cmp == 0);
-        else if (peek.type == TOK_NOT_EQUAL)
-          res = (cmp != 0);
-        else if (peek.type == TOK_LESS)
-          res = (cmp < 0);
-        else if (peek.type == TOK_GREATER)
-          res = (cmp > 0);
-        else if (peek.type == TOK_LESS_EQUAL)
-          res = (cmp <= 0);
-        else if (peek.type == TOK_GREATER_EQUAL)
-          res = (cmp >= 0);
-        safe_free(left.string);
-        safe_free(right.string);
-      } else if (!left.is_string && !right.is_string) {
-        if (peek.type == TOK_EQUAL)
-          res = (left.number == right.number);
-        else if (peek.type == TOK_NOT_EQUAL)
-          res = (left.number != right.number);
-        else if (peek.type == TOK_LESS)
-          res = (left.number < right.number);
-        else if (peek.type == TOK_GREATER)
-          res = (left.number > right.number);
-        else if (peek.type == TOK_LESS_EQUAL)
-          res = (left.number <= right.number);
-        else if (peek.type == TOK_GREATER_EQUAL)
-          res = (left.number >= right.number);
-      }
-
-      left.is_string = false;
-      left.number = res ? -1 : 0; // BASIC true is -1
-      token_free(&peek);
+  } else if (token.type == TOK_SEARCH) {
+    val.number = search_function(interp, lexer);
+  } else if (token.type == TOK_EXISTS) {
+    char *key = NULL;
+    Variable *map = expect_token(interp, lexer, TOK_LPAREN)
+                        ? map_arg(interp, lexer, &key)
+                        : NULL;
+    if (map && expect_token(interp, lexer, TOK_RPAREN)) {
+      if (!key)
+        interpreter_error(interp, "SYNTAX");
+      else if (map_find(&map->value.map, key))
+        val.number = -1;
+    }
+    safe_free(key);
+  } else if (token.type == TOK_KEY) {
+    /* KEY$(H{}, i): the i-th key, 0-based */
+    char *key = NULL;
+    double n;
+    Variable *map = expect_token(interp, lexer, TOK_LPAREN)
+                        ? map_arg(interp, lexer, &key)
+                        : NULL;
+    if (map && key) {
+      interpreter_error(interp, "SYNTAX");
+    } else if (map && expect_token(interp, lexer, TOK_COMMA) &&
+               parse_numbers(interp, lexer, &n, 1, 1) == 1 &&
+               expect_token(interp, lexer, TOK_RPAREN)) {
+      if (n < 0) {
+        interpreter_error(interp, "ILLEGAL QUANTITY");
+      } else if (!(n < (double)map->value.map.count)) {
+        interpreter_error(interp, "BAD SUBSCRIPT");
+      } else {
+        val.is_string = true;
+        val.string = str_duplicate(map->value.map.entries[(size_t)n].key);
+      }
+    }
+    safe_free(key);
+  } else if (token.type == TOK_LEN &&
+             expect_token(interp, lexer, TOK_LPAREN)) {
+    /* LEN(s$), or LEN(H{}) for the number of keys */
+    if (next_is_whole_map(lexer)) {
+      char *key;
+      Variable *map = map_arg(interp, lexer, &key);
+      if (map && expect_token(interp, lexer, TOK_RPAREN))
+        val.number = (double)map->value.map.count;
     } else {
-      token_free(&peek);
-      break;
+      Value v = evaluate_expression(interp, lexer);
+      if (!v.is_string && !interp->error_occurred)
+        interpreter_error(interp, "TYPE MISMATCH");
+      else if (v.is_string && expect_token(interp, lexer, TOK_RPAREN))
+        val.number = (double)strlen(v.string);
+      if (v.is_string)
+        safe_free(v.string);
+    }
+  } else if (token.type == TOK_RND &&
+             expect_token(interp, lexer, TOK_LPAREN)) {
+    /* As on the C64: RND(1) is the next number, RND(0) reseeds from the
+     * clock, and RND(-n) reseeds from n, so equal n repeat a sequence */
+    double x;
+    if (parse_numbers(interp, lexer, &x, 1, 1) == 1 &&
+        expect_token(interp, lexer, TOK_RPAREN)) {
+      if (x < 0) {
+        uint64_t bits;
+        memcpy(&bits, &x, sizeof(bits));
+        rng_seed(&interp->rng, bits);
+      } else if (x == 0) {
+        rng_seed(&interp->rng, clock_seed(interp));
+      }
+      val.number = rng_double(&interp->rng);
     }
+  } else if (token.type == TOK_PEEK) {
+    token_free(&token);
+    Token lparen = lexer_next_token(lexer);
+    token_free(&lparen);
+    Value v = evaluate_expression(interp, lexer);
+    Token rparen = lexer_next_token(lexer);
+    token_free(&rparen);
+
+    val.is_string = false;
+    if (v.is_string)
+      safe_free(v.string);
+    else if (in_range(interp, &v.number, 1, 0, RAM_SIZE - 1))
+      val.number = mem_peek(interp, (uint16_t)v.number);
   }
-  return left;
+
+  token_free(&token);
+  return val;
+}
+
+/* Precedence, loosest first: OR, AND, NOT, relations, + -, * /, unary
+ * minus, ^. Integer operands take integer paths throughout, falling back
+ * to doubles only when a result leaves the 32-bit range. Code has been
+ * through compile_code, so the operators here know their operand types:
+ * strings only meet TOK_CONCAT and the string relations.
+ *
+ * Each level builds its result in the caller's Value rather than
+ * returning one, so an operand passes up through the levels without
+ * being copied at each. */
+static void negate(Value *v) {
+  *v = v->is_integer ? integer_value(-(int64_t)v->integer)
+                     : number_value(-v->number);
+}
+
+/* Right operand of ^: signs and a factor only, so 2^3^2 is (2^3)^2 as in
+ * CBM BASIC, and 2^-1 is allowed */
+static void evaluate_exponent(Interpreter *interp, Lexer *lexer, Value *out) {
+  TokenType sign = lexer_peek_type(lexer);
+  if (sign != TOK_MINUS && sign != TOK_PLUS) {
+    *out = evaluate_factor(interp, lexer);
+    return;
+  }
+  skip_token(lexer);
+  evaluate_exponent(interp, lexer, out);
+  if (sign == TOK_MINUS)
+    negate(out);
+}
+
+static void evaluate_power(Interpreter *interp, Lexer *lexer, Value *out) {
+  *out = evaluate_factor(interp, lexer);
+  while (!interp->error_occurred && lexer_peek_type(lexer) == TOK_POWER) {
+    skip_token(lexer);
+    Value right;
+    evaluate_exponent(interp, lexer, &right);
+    *out = number_value(pow(value_number(out), value_number(&right)));
+  }
+}
+
+/* -2^2 is -4 */
+static void evaluate_unary(Interpreter *interp, Lexer *lexer, Value *out) {
+  TokenType sign = lexer_peek_type(lexer);
+  if (sign != TOK_MINUS && sign != TOK_PLUS) {
+    evaluate_power(interp, lexer, out);
+    return;
+  }
+  skip_token(lexer);
+  evaluate_unary(interp, lexer, out);
+  if (sign == TOK_MINUS)
+    negate(out);
+}
+
+static void evaluate_term(Interpreter *interp, Lexer *lexer, Value *out) {
+  evaluate_unary(interp, lexer, out);
+  TokenType op;
+  while (!interp->error_occurred &&
+         ((op = lexer_peek_type(lexer)) == TOK_MULTIPLY || op == TOK_DIVIDE)) {
+    skip_token(lexer);
+    Value right;
+    evaluate_unary(interp, lexer, &right);
+    if (op == TOK_MULTIPLY && out->is_integer && right.is_integer)
+      *out = integer_value((int64_t)out->integer * right.integer);
+    else if (op == TOK_MULTIPLY)
+      *out = number_value(value_number(out) * value_number(&right));
+    else if (value_number(&right) == 0)
+      interpreter_error(interp, "DIVISION BY ZERO");
+    else
+      *out = number_value(value_number(out) / value_number(&right));
+  }
+}
+
+static void evaluate_sum(Interpreter *interp, Lexer *lexer, Value *out) {
+  evaluate_term(interp, lexer, out);
+  TokenType op;
+  while (!interp->error_occurred &&
+         ((op = lexer_peek_type(lexer)) == TOK_PLUS || op == TOK_MINUS ||
+          op == TOK_CONCAT)) {
+    skip_token(lexer);
+    Value right;
+    evaluate_term(interp, lexer, &right);
+    if (op == TOK_CONCAT) {
+      /* After an error the right operand may be a default 0 */
+      char *new_str = NULL;
+      if (!interp->error_occurred) {
+        size_t left_len = strlen(out->string);
+        size_t right_len = strlen(right.string);
+        new_str = safe_malloc(left_len + right_len + 1);
+        if (new_str) {
+          memcpy(new_str, out->string, left_len);
+          memcpy(new_str + left_len, right.string, right_len + 1);
+        } else {
+          interpreter_error(interp, "OUT OF MEMORY");
+        }
+      }
+      safe_free(out->string);
+      safe_free(right.string);
+      out->string = new_str;
+    } else if (out->is_integer && right.is_integer) {
+      *out = integer_value(op == TOK_PLUS
+                               ? (int64_t)out->integer + right.integer
+                               : (int64_t)out->integer - right.integer);
+    } else {
+      *out = number_value(op == TOK_PLUS
+                              ? value_number(out) + value_number(&right)
+                              : value_number(out) - value_number(&right));
+    }
+  }
+}
+
+static bool is_relation(TokenType type) {
+  return (type >= TOK_EQUAL && type <= TOK_GREATER_EQUAL) ||
+         (type >= TOK_STR_EQUAL && type <= TOK_STR_GREATER_EQUAL);
+}
+
+static void evaluate_relation(Interpreter *interp, Lexer *lexer, Value *out) {
+  evaluate_sum(interp, lexer, out);
+  TokenType op;
+  while (!interp->error_occurred && is_relation(op = lexer_peek_type(lexer))) {
+    skip_token(lexer);
+    Value right;
+    evaluate_sum(interp, lexer, &right);
+    int cmp;
+    if (op >= TOK_STR_EQUAL) {
+      cmp = interp->error_occurred ? 0 : strcmp(out->string, right.string);
+      safe_free(out->string);
+      safe_free(right.string);
+      op = (TokenType)(op - TOK_STR_EQUAL + TOK_EQUAL);
+    } else if (out->is_integer && right.is_integer) {
+      cmp = (out->integer > right.integer) - (out->integer < right.integer);
+    } else {
+      double a = value_number(out), b = value_number(&right);
+      cmp = (a > b) - (a < b);
+    }
+    bool res = op == TOK_EQUAL       ? cmp == 0
+               : op == TOK_NOT_EQUAL ? cmp != 0
+               : op == TOK_LESS      ? cmp < 0
+               : op == TOK_GREATER   ? cmp > 0
+               : op == TOK_LESS_EQUAL ? cmp <= 0
+                                      : cmp >= 0;
+    *out = integer_value(res ? -1 : 0); // BASIC true is -1
+  }
+}
+
+/* NOT, AND and OR work bit by bit on INT of their operands */
+static void evaluate_not(Interpreter *interp, Lexer *lexer, Value *out) {
+  if (lexer_peek_type(lexer) != TOK_NOT) {
+    evaluate_relation(interp, lexer, out);
+    return;
+  }
+  skip_token(lexer);
+  evaluate_not(interp, lexer, out);
+  int32_t n;
+  *out = value_integer(interp, out, &n) ? integer_value(~n) : number_value(0);
+}
+
+static void evaluate_logic(Interpreter *interp, Lexer *lexer, TokenType op,
+                           Value *out) {
+  if (op == TOK_OR)
+    evaluate_logic(interp, lexer, TOK_AND, out);
+  else
+    evaluate_not(interp, lexer, out);
+  while (!interp->error_occurred && lexer_peek_type(lexer) == op) {
+    skip_token(lexer);
+    Value right;
+    if (op == TOK_OR)
+      evaluate_logic(interp, lexer, TOK_AND, &right);
+    else
+      evaluate_not(interp, lexer, &right);
+    int32_t a, b;
+    if (!value_integer(interp, out, &a) ||
+        !value_integer(interp, &right, &b))
+      break;
+    *out = integer_value(op == TOK_AND ? a & b : a | b);
+  }
+}
+
+Value evaluate_expression(Interpreter *interp, Lexer *lexer) {
+  Value v;
+  evaluate_logic(interp, lexer, TOK_OR, &v);
+  if (v.is_integer)
+    v.number = v.integer;
+  return v;
 }
 
 static void draw_line(Interpreter *interp, int x1, int y1, int x2, int y2) {
-  if (!interp->editor)
+  gfx_line(&interp->bitmap, x1, y1, x2, y2);
+  if (interp->editor)
+    gfx_render(&interp->bitmap, interp->editor);
+}
+
+/* Parse `min`..`max` comma-separated numeric arguments into `out`.
+ * Returns the count parsed, or -1 (with an error raised) on bad input. */
+static int parse_numbers(Interpreter *interp, Lexer *lexer, double *out,
+                         int min, int max) {
+  int count = 0;
+  while (count < max) {
+    Value v = evaluate_expression(interp, lexer);
+    if (v.is_string) {
+      safe_free(v.string);
+      interpreter_error(interp, "TYPE MISMATCH");
+      return -1;
+    }
+    out[count++] = v.number;
+    if (count == max)
+      break;
+
+    Token peek = lexer_peek_token(lexer);
+    bool more = peek.type == TOK_COMMA;
+    token_free(&peek);
+    if (!more)
+      break;
+    Token comma = lexer_next_token(lexer);
+    token_free(&comma);
+  }
+  if (count < min) {
+    interpreter_error(interp, "SYNTAX");
+    return -1;
+  }
+  return count;
+}
+
+/* "(i, j, ...)" after an array name: the element's row-major index. An
+ * array used before any DIM gets ARRAY_AUTO_BOUND in each dimension.
+ * Returns NULL after an error. */
+static Variable *array_element(Interpreter *interp, Lexer *lexer,
+                               const char *name, size_t *index) {
+  Token lparen = lexer_next_token(lexer);
+  token_free(&lparen);
+  double subs[ARRAY_MAX_DIMS];
+  int count = parse_numbers(interp, lexer, subs, 1, ARRAY_MAX_DIMS);
+  if (count < 0)
+    return NULL;
+  Token rparen = lexer_next_token(lexer);
+  bool ok = rparen.type == TOK_RPAREN;
+  token_free(&rparen);
+  if (!ok) {
+    interpreter_error(interp, "SYNTAX");
+    return NULL;
+  }
+
+  Variable *arr = array_get(interp, name);
+  if (!arr) {
+    int dims[ARRAY_MAX_DIMS];
+    for (int i = 0; i < count; i++)
+      dims[i] = ARRAY_AUTO_BOUND + 1;
+    arr = array_create(interp, name, dims, count);
+    if (!arr)
+      return NULL;
+  }
+  if (count != arr->value.array.dim_count) {
+    interpreter_error(interp, "BAD SUBSCRIPT");
+    return NULL;
+  }
+
+  size_t at = 0;
+  for (int i = 0; i < count; i++) {
+    if (subs[i] < 0) {
+      interpreter_error(interp, "ILLEGAL QUANTITY");
+      return NULL;
+    }
+    if (!(subs[i] < arr->value.array.dimensions[i])) {
+      interpreter_error(interp, "BAD SUBSCRIPT");
+      return NULL;
+    }
+    at += (size_t)subs[i] * (size_t)arr->value.array.strides[i];
+  }
+  *index = at;
+  return arr;
+}
+
+/* Where LET, READ and INPUT store a value: a scalar variable by name,
+ * one array element or one map key */
+typedef struct {
+  char *name;      // Owned
+  Variable *array; // Set for an element
+  size_t index;
+  char *key;       // Owned; set for a map key
+  bool is_string;  // The name ends in $
+  bool is_integer; // The name ends in %
+} Target;
+
+/* Target named by `name` (taken over) plus any subscripts that follow */
+static bool target_init(Interpreter *interp, Lexer *lexer, char *name,
+                        Target *t) {
+  t->name = name;
+  t->array = NULL;
+  t->key = NULL;
+  t->is_string = t->name[strlen(t->name) - 1] == '$';
+  t->is_integer = t->name[strlen(t->name) - 1] == '%';
+  if (next_is(lexer, TOK_LPAREN)) {
+    t->array = array_element(interp, lexer, t->name, &t->index);
+    if (!t->array) {
+      safe_free(t->name);
+      return false;
+    }
+  } else if (next_is(lexer, TOK_LBRACE)) {
+    if (map_key(interp, lexer, &t->key) && !t->key)
+      interpreter_error(interp, "SYNTAX");
+    if (!t->key) {
+      safe_free(t->name);
+      return false;
+    }
+  }
+  return true;
+}
+
+/* The map entry for a key target, added if new. The map is looked up only
+ * now, as evaluating the value may have created it. */
+static MapEntry *target_entry(Interpreter *interp, Target *t) {
+  Variable *map = map_get(interp, t->name);
+  if (!map)
+    map = map_create(interp, t->name);
+  MapEntry *entry = map ? map_insert(&map->value.map, t->key) : NULL;
+  if (map && !entry)
+    interpreter_error(interp, "OUT OF MEMORY");
+  return entry;
+}
+
+static bool parse_target(Interpreter *interp, Lexer *lexer, Target *t) {
+  Token name = lexer_next_token(lexer);
+  if (name.type != TOK_IDENTIFIER) {
+    token_free(&name);
+    interpreter_error(interp, "SYNTAX");
+    return false;
+  }
+  return target_init(interp, lexer, name.text, t);
+}
+
+static void target_set_number(Interpreter *interp, Target *t, double value);
+
+/* Integer targets store integers as they are; others store them as
+ * doubles */
+static void target_set_integer(Interpreter *interp, Target *t,
+                               int32_t value) {
+  if (!t->is_integer) {
+    target_set_number(interp, t, value);
+  } else if (t->key) {
+    MapEntry *entry = target_entry(interp, t);
+    if (entry)
+      entry->value.number = value;
+  } else if (!t->array) {
+    var_set_integer(interp, t->name, value);
+  } else {
+    ((int32_t *)t->array->value.array.data)[t->index] = value;
+    t->array->value.array.sorted = 0;
+  }
+}
+
+/* Integer targets take INT(value), which must fit in 32 bits */
+static void target_set_number(Interpreter *interp, Target *t, double value) {
+  int32_t n;
+  if (t->is_integer) {
+    if (to_integer(interp, value, &n))
+      target_set_integer(interp, t, n);
+  } else if (t->key) {
+    MapEntry *entry = t->is_string ? NULL : target_entry(interp, t);
+    if (entry)
+      entry->value.number = value;
+    else if (t->is_string)
+      interpreter_error(interp, "TYPE MISMATCH");
+  } else if (!t->array) {
+    var_set_number(interp, t->name, value);
+  } else if (t->array->type == VAR_ARRAY_NUMBER) {
+    ((double *)t->array->value.array.data)[t->index] = value;
+    t->array->value.array.sorted = 0;
+  } else {
+    interpreter_error(interp, "TYPE MISMATCH");
+  }
+}
+
+static void target_set_string(Interpreter *interp, Target *t,
+                              const char *value) {
+  if (t->key) {
+    MapEntry *entry = t->is_string ? target_entry(interp, t) : NULL;
+    char *copy = entry ? str_duplicate(value) : NULL;
+    if (copy) {
+      safe_free(entry->value.string);
+      entry->value.string = copy;
+    } else if (!t->is_string) {
+      interpreter_error(interp, "TYPE MISMATCH");
+    } else if (entry) {
+      interpreter_error(interp, "OUT OF MEMORY");
+    }
+  } else if (t->is_integer) {
+    interpreter_error(interp, "TYPE MISMATCH");
+  } else if (!t->array) {
+    var_set_string(interp, t->name, value);
+  } else if (t->array->type == VAR_ARRAY_STRING) {
+    char **elem = (char **)t->array->value.array.data + t->index;
+    safe_free(*elem);
+    *elem = str_duplicate(value);
+    t->array->value.array.sorted = 0;
+  } else {
+    interpreter_error(interp, "TYPE MISMATCH");
+  }
+}
+
+static void target_free(Target *t) {
+  safe_free(t->name);
+  safe_free(t->key);
+}
+
+/* One DIM entry: "(i[, j...])" after an array name, where extents are one
+ * more than each bound, or "{}" after a map name */
+static void dim_variable(Interpreter *interp, Lexer *lexer, const char *name) {
+  if (next_is(lexer, TOK_LBRACE)) {
+    char *key;
+    if (map_key(interp, lexer, &key) && key)
+      interpreter_error(interp, "SYNTAX");
+    else if (!interp->error_occurred && map_get(interp, name))
+      interpreter_error(interp, "REDIM'D ARRAY");
+    else if (!interp->error_occurred)
+      map_create(interp, name);
+    safe_free(key);
     return;
+  }
+
+  double bounds[ARRAY_MAX_DIMS];
+  int count = -1;
+  bool ok = next_is(lexer, TOK_LPAREN);
+  if (ok) {
+    Token lparen = lexer_next_token(lexer);
+    token_free(&lparen);
+    count = parse_numbers(interp, lexer, bounds, 1, ARRAY_MAX_DIMS);
+    Token rparen = lexer_next_token(lexer);
+    ok = rparen.type == TOK_RPAREN;
+    token_free(&rparen);
+  }
+  if (count < 0 || !ok) {
+    if (!interp->error_occurred)
+      interpreter_error(interp, "SYNTAX");
+    return;
+  }
+
+  int dims[ARRAY_MAX_DIMS];
+  for (int i = 0; i < count && !interp->error_occurred; i++) {
+    if (bounds[i] < 0 || bounds[i] >= INT_MAX)
+      interpreter_error(interp, "ILLEGAL QUANTITY");
+    dims[i] = (int)bounds[i] + 1;
+  }
+  if (!interp->error_occurred) {
+    if (array_get(interp, name))
+      interpreter_error(interp, "REDIM'D ARRAY");
+    else
+      array_create(interp, name, dims, count);
+  }
+}
+
+/* DIM A(i[, j...])[, B$(...)][, H{}] */
+static void dim_statement(Interpreter *interp, Lexer *lexer) {
+  while (true) {
+    Token name = lexer_next_token(lexer);
+    if (name.type == TOK_IDENTIFIER)
+      dim_variable(interp, lexer, name.text);
+    else
+      interpreter_error(interp, "SYNTAX");
+    token_free(&name);
+    if (interp->error_occurred || !next_is_comma(lexer))
+      return;
+    Token comma = lexer_next_token(lexer);
+    token_free(&comma);
+  }
+}
+
+/* MAT works on whole numeric arrays, subscript 0 included. A 1-D array
+ * is a column vector; shapes must agree or the result is BAD SUBSCRIPT. */
+static Variable *mat_source(Interpreter *interp, const char *name) {
+  Variable *arr = array_get(interp, name);
+  if (!arr)
+    interpreter_error(interp, "BAD SUBSCRIPT");
+  else if (arr->type != VAR_ARRAY_NUMBER)
+    interpreter_error(interp, "TYPE MISMATCH");
+  return interp->error_occurred ? NULL : arr;
+}
+
+static void mat_shape(Variable *arr, size_t *rows, size_t *cols) {
+  *rows = (size_t)arr->value.array.dimensions[0];
+  *cols = arr->value.array.dim_count > 1
+              ? (size_t)arr->value.array.dimensions[1]
+              : 1;
+}
+
+static bool mat_same_shape(Variable *a, Variable *b) {
+  return a->value.array.dim_count == b->value.array.dim_count &&
+         memcmp(a->value.array.dimensions, b->value.array.dimensions,
+                (size_t)a->value.array.dim_count * sizeof(int)) == 0;
+}
+
+/* The destination array: created with the result's shape if it does not
+ * exist yet, otherwise it must already have that shape */
+static Variable *mat_dest(Interpreter *interp, const char *name,
+                          const int *dims, int dim_count) {
+  Variable *arr = array_get(interp, name);
+  if (!arr) {
+    char suffix = name[strlen(name) - 1];
+    if (suffix == '$' || suffix == '%') {
+      interpreter_error(interp, "TYPE MISMATCH");
+      return NULL;
+    }
+    return array_create(interp, name, dims, dim_count);
+  }
+  if (arr->type != VAR_ARRAY_NUMBER) {
+    interpreter_error(interp, "TYPE MISMATCH");
+    return NULL;
+  }
+  if (arr->value.array.dim_count != dim_count ||
+      memcmp(arr->value.array.dimensions, dims,
+             (size_t)dim_count * sizeof(int)) != 0) {
+    interpreter_error(interp, "BAD SUBSCRIPT");
+    return NULL;
+  }
+  arr->value.array.sorted = 0;
+  return arr;
+}
+
+/* Run a product or transpose into dst, through a scratch block when dst is
+ * also an operand */
+static void mat_into(Interpreter *interp, Variable *dst, Variable *a,
+                     Variable *b, size_t rows, size_t inner, size_t cols) {
+  double *out = dst->value.array.data;
+  bool alias = dst == a || dst == b;
+  if (alias) {
+    out = safe_malloc(dst->value.array.count * sizeof(double));
+    if (!out) {
+      interpreter_error(interp, "OUT OF MEMORY");
+      return;
+    }
+  }
+  if (b)
+    mat_multiply(out, a->value.array.data, b->value.array.data, rows, inner,
+                 cols);
+  else
+    mat_transpose(out, a->value.array.data, rows, cols);
+  if (alias) {
+    memcpy(dst->value.array.data, out,
+           dst->value.array.count * sizeof(double));
+    safe_free(out);
+  }
+}
 
-  // Scale from C64/C128 resolution (320x200) to terminal size
-  int tx1 = x1 * interp->editor->cols / 320;
-  int ty1 = y1 * interp->editor->rows / 200;
-  int tx2 = x2 * interp->editor->cols / 320;
-  int ty2 = y2 * interp->editor->rows / 200;
+static char *mat_operand(Interpreter *interp, Lexer *lexer) {
+  Token name = lexer_next_token(lexer);
+  if (name.type == TOK_IDENTIFIER)
+    return name.text;
+  token_free(&name);
+  interpreter_error(interp, "SYNTAX");
+  return NULL;
+}
+
+/* Right-hand side of a MAT statement */
+typedef enum {
+  MAT_COPY,
+  MAT_ADD,
+  MAT_SUB,
+  MAT_MUL,
+  MAT_SCALE,
+  MAT_TRN,
+  MAT_ZER,
+  MAT_CON,
+  MAT_IDN
+} MatOp;
+
+typedef struct {
+  MatOp op;
+  char *left;  // First operand
+  char *right; // Second operand of + - *
+  double k;    // Factor of (k) * A
+} MatExpr;
+
+/* A + B | A - B | A * B | (k) * A | TRN(A) | A | ZER | CON | IDN */
+static bool mat_parse(Interpreter *interp, Lexer *lexer, MatExpr *e) {
+  if (next_is(lexer, TOK_LPAREN)) {
+    Token lparen = lexer_next_token(lexer);
+    token_free(&lparen);
+    e->op = MAT_SCALE;
+    return parse_numbers(interp, lexer, &e->k, 1, 1) == 1 &&
+           expect_token(interp, lexer, TOK_RPAREN) &&
+           expect_token(interp, lexer, TOK_MULTIPLY) &&
+           (e->left = mat_operand(interp, lexer)) != NULL;
+  }
 
-  int dx = abs(tx2 - tx1);
-  int dy = abs(ty2 - ty1);
-  int sx = (tx1 < tx2) ? 1 : -1;
-  int sy = (ty1 < ty2) ? 1 : -1;
-  int err = dx - dy;
+  if (!(e->left = mat_operand(interp, lexer)))
+    return false;
+  static const struct {
+    const char *name;
+    MatOp op;
+  } words[] = {{"ZER", MAT_ZER}, {"CON", MAT_CON}, {"IDN", MAT_IDN}};
+  for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+    if (str_compare_nocase(e->left, words[i].name) == 0) {
+      e->op = words[i].op;
+      return true;
+    }
+  }
+  if (str_compare_nocase(e->left, "TRN") == 0) {
+    safe_free(e->left);
+    e->left = NULL;
+    e->op = MAT_TRN;
+    return expect_token(interp, lexer, TOK_LPAREN) &&
+           (e->left = mat_operand(interp, lexer)) != NULL &&
+           expect_token(interp, lexer, TOK_RPAREN);
+  }
+
+  Token op = lexer_peek_token(lexer);
+  e->op = op.type == TOK_PLUS       ? MAT_ADD
+          : op.type == TOK_MINUS    ? MAT_SUB
+          : op.type == TOK_MULTIPLY ? MAT_MUL
+                                    : MAT_COPY;
+  token_free(&op);
+  if (e->op == MAT_COPY)
+    return true;
+  op = lexer_next_token(lexer);
+  token_free(&op);
+  return (e->right = mat_operand(interp, lexer)) != NULL;
+}
 
-  while (1) {
-    editor_plot(interp->editor, tx1, ty1, '*');
-    if (tx1 == tx2 && ty1 == ty2)
+static void mat_execute(Interpreter *interp, const char *dest, MatExpr *e) {
+  if (e->op == MAT_ZER || e->op == MAT_CON || e->op == MAT_IDN) {
+    Variable *c = mat_source(interp, dest);
+    if (!c)
+      return;
+    size_t rows, cols;
+    mat_shape(c, &rows, &cols);
+    double *data = c->value.array.data;
+    if (e->op == MAT_IDN && (c->value.array.dim_count != 2 || rows != cols)) {
+      interpreter_error(interp, "BAD SUBSCRIPT");
+      return;
+    }
+    mat_fill(data, e->op == MAT_CON ? 1 : 0, c->value.array.count);
+    c->value.array.sorted = 0;
+    if (e->op == MAT_IDN)
+      for (size_t i = 0; i < rows; i++)
+        data[i * cols + i] = 1;
+    return;
+  }
+
+  Variable *a = mat_source(interp, e->left);
+  Variable *b = e->right ? mat_source(interp, e->right) : NULL;
+  if (!a || (e->right && !b))
+    return;
+  int *dims = a->value.array.dimensions;
+  int dim_count = a->value.array.dim_count;
+  Variable *c;
+
+  switch (e->op) {
+  case MAT_COPY:
+    c = mat_dest(interp, dest, dims, dim_count);
+    if (c && c != a)
+      memcpy(c->value.array.data, a->value.array.data,
+             a->value.array.count * sizeof(double));
+    break;
+  case MAT_SCALE:
+    c = mat_dest(interp, dest, dims, dim_count);
+    if (c)
+      mat_scale(c->value.array.data, a->value.array.data, e->k,
+                a->value.array.count);
+    break;
+  case MAT_ADD:
+  case MAT_SUB:
+    if (!mat_same_shape(a, b)) {
+      interpreter_error(interp, "BAD SUBSCRIPT");
       break;
-    int e2 = 2 * err;
-    if (e2 > -dy) {
-      err -= dy;
-      tx1 += sx;
     }
-    if (e2 < dx) {
-      err += dx;
-      ty1 += sy;
+    c = mat_dest(interp, dest, dims, dim_count);
+    if (c && e->op == MAT_ADD)
+      mat_add(c->value.array.data, a->value.array.data, b->value.array.data,
+              a->value.array.count);
+    else if (c)
+      mat_sub(c->value.array.data, a->value.array.data, b->value.array.data,
+              a->value.array.count);
+    break;
+  case MAT_MUL: {
+    size_t rows, inner, inner_b, cols;
+    mat_shape(a, &rows, &inner);
+    mat_shape(b, &inner_b, &cols);
+    if (dim_count > 2 || b->value.array.dim_count > 2 || inner != inner_b) {
+      interpreter_error(interp, "BAD SUBSCRIPT");
+      break;
+    }
+    /* A matrix times a vector is a vector */
+    int out[2] = {(int)rows, (int)cols};
+    c = mat_dest(interp, dest, out, b->value.array.dim_count == 1 ? 1 : 2);
+    if (c)
+      mat_into(interp, c, a, b, rows, inner, cols);
+    break;
+  }
+  case MAT_TRN: {
+    size_t rows, cols;
+    mat_shape(a, &rows, &cols);
+    if (dim_count > 2) {
+      interpreter_error(interp, "BAD SUBSCRIPT");
+      break;
     }
+    int out[2] = {(int)cols, (int)rows};
+    c = mat_dest(interp, dest, out, 2);
+    if (c)
+      mat_into(interp, c, a, NULL, rows, 0, cols);
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+/* MAT C = <expression>, see mat_parse() */
+static void mat_statement(Interpreter *interp, Lexer *lexer) {
+  char *dest = mat_operand(interp, lexer);
+  MatExpr e = {MAT_COPY, NULL, NULL, 0};
+  if (dest && expect_token(interp, lexer, TOK_EQUAL) &&
+      mat_parse(interp, lexer, &e))
+    mat_execute(interp, dest, &e);
+  safe_free(dest);
+  safe_free(e.left);
+  safe_free(e.right);
+}
+
+/* "H{key}" or "H{}" naming a map, which is created if it does not exist
+ * yet, as arrays are. NULL (and no key) after an error. */
+static Variable *map_arg(Interpreter *interp, Lexer *lexer, char **key) {
+  *key = NULL;
+  Token name = lexer_next_token(lexer);
+  Variable *map = NULL;
+  if (name.type != TOK_IDENTIFIER) {
+    interpreter_error(interp, "SYNTAX");
+  } else if (map_key(interp, lexer, key)) {
+    map = map_get(interp, name.text);
+    if (!map)
+      map = map_create(interp, name.text);
   }
+  token_free(&name);
+  if (!map) {
+    safe_free(*key);
+    *key = NULL;
+  }
+  return map;
+}
+
+/* DELETE H{key} removes one key (if present); DELETE H{} removes all */
+static void delete_statement(Interpreter *interp, Lexer *lexer) {
+  char *key;
+  Variable *map = map_arg(interp, lexer, &key);
+  if (!map)
+    return;
+  if (key)
+    map_delete(&map->value.map, key);
+  else
+    map_free(&map->value.map);
+  safe_free(key);
 }
 
+/* "A()" or "A(lo TO hi)": a 1-D array and the subscripts to work on */
+static Variable *array_range(Interpreter *interp, Lexer *lexer, size_t *from,
+                             size_t *to) {
+  Token name = lexer_next_token(lexer);
+  bool ok = name.type == TOK_IDENTIFIER;
+  Variable *arr = ok ? array_get(interp, name.text) : NULL;
+  token_free(&name);
+  if (!ok) {
+    interpreter_error(interp, "SYNTAX");
+    return NULL;
+  }
+
+  double range[2];
+  bool whole = false;
+  if (!expect_token(interp, lexer, TOK_LPAREN))
+    return NULL;
+  if (next_is(lexer, TOK_RPAREN))
+    whole = true;
+  else if (parse_numbers(interp, lexer, &range[0], 1, 1) < 0 ||
+           !expect_token(interp, lexer, TOK_TO) ||
+           parse_numbers(interp, lexer, &range[1], 1, 1) < 0)
+    return NULL;
+  if (!expect_token(interp, lexer, TOK_RPAREN))
+    return NULL;
+
+  if (!arr || arr->value.array.dim_count != 1) {
+    interpreter_error(interp, "BAD SUBSCRIPT");
+    return NULL;
+  }
+  if (whole) {
+    *from = 0;
+    *to = arr->value.array.count - 1;
+  } else if (range[0] < 0 || range[1] < range[0]) {
+    interpreter_error(interp, "ILLEGAL QUANTITY");
+    return NULL;
+  } else if (!(range[1] < (double)arr->value.array.count)) {
+    interpreter_error(interp, "BAD SUBSCRIPT");
+    return NULL;
+  } else {
+    *from = (size_t)range[0];
+    *to = (size_t)range[1];
+  }
+  return arr;
+}
+
+/* Numeric 1-D array (I() or I%()) to receive SORT's index, created if
+ * needed */
+static Variable *sort_index_array(Interpreter *interp, Lexer *lexer,
+                                  Variable *sorted) {
+  Token name = lexer_next_token(lexer);
+  if (name.type != TOK_IDENTIFIER) {
+    token_free(&name);
+    interpreter_error(interp, "SYNTAX");
+    return NULL;
+  }
+  Variable *index = NULL;
+  if (expect_token(interp, lexer, TOK_LPAREN) &&
+      expect_token(interp, lexer, TOK_RPAREN)) {
+    int extent = (int)sorted->value.array.count;
+    index = array_get(interp, name.text);
+    if (!index && name.text[strlen(name.text) - 1] != '$')
+      index = array_create(interp, name.text, &extent, 1);
+    else if (!index || index->type == VAR_ARRAY_STRING)
+      interpreter_error(interp, "TYPE MISMATCH");
+    else if (index == sorted || index->value.array.dim_count != 1 ||
+             index->value.array.count < sorted->value.array.count)
+      interpreter_error(interp, "BAD SUBSCRIPT");
+  }
+  token_free(&name);
+  return interp->error_occurred ? NULL : index;
+}
+
+/* SORT A([lo TO hi])[, descending[, I()]]: stable, in place. I() receives
+ * the original subscript of each element now at lo..hi. */
+static void sort_statement(Interpreter *interp, Lexer *lexer) {
+  size_t from, to;
+  Variable *arr = array_range(interp, lexer, &from, &to);
+  if (!arr)
+    return;
+
+  double descending = 0;
+  Variable *index = NULL;
+  if (next_is_comma(lexer)) {
+    Token comma = lexer_next_token(lexer);
+    token_free(&comma);
+    if (parse_numbers(interp, lexer, &descending, 1, 1) < 0)
+      return;
+    if (next_is_comma(lexer)) {
+      comma = lexer_next_token(lexer);
+      token_free(&comma);
+      if (!(index = sort_index_array(interp, lexer, arr)))
+        return;
+    }
+  }
+
+  size_t n = to - from + 1;
+  uint32_t *order = index ? safe_malloc(n * sizeof(uint32_t)) : NULL;
+  bool ok = !index || order;
+  if (ok && arr->type == VAR_ARRAY_NUMBER)
+    ok = sort_numbers((double *)arr->value.array.data + from, n,
+                      descending != 0, order);
+  else if (ok && arr->type == VAR_ARRAY_INTEGER)
+    ok = sort_integers((int32_t *)arr->value.array.data + from, n,
+                       descending != 0, order);
+  else if (ok)
+    ok = sort_strings((char **)arr->value.array.data + from, n,
+                      descending != 0, order);
+  if (!ok) {
+    safe_free(order);
+    interpreter_error(interp, "OUT OF MEMORY");
+    return;
+  }
+
+  if (index) {
+    for (size_t i = 0; i < n; i++) {
+      if (index->type == VAR_ARRAY_INTEGER)
+        ((int32_t *)index->value.array.data)[from + i] =
+            (int32_t)(from + order[i]);
+      else
+        ((double *)index->value.array.data)[from + i] =
+            (double)(from + order[i]);
+    }
+    index->value.array.sorted = 0;
+    safe_free(order);
+  }
+  arr->value.array.sorted = descending != 0 ? -1 : 1;
+  arr->value.array.sorted_from = from;
+  arr->value.array.sorted_to = to;
+}
+
+/* SEARCH(A([lo TO hi]), x): subscript of the first element equal to x, or
+ * -1. Binary search when SORT left that range ordered, else a scan. */
+static double search_function(Interpreter *interp, Lexer *lexer) {
+  size_t from, to;
+  Variable *arr;
+  if (!expect_token(interp, lexer, TOK_LPAREN) ||
+      !(arr = array_range(interp, lexer, &from, &to)) ||
+      !expect_token(interp, lexer, TOK_COMMA))
+    return -1;
+  Value x = evaluate_expression(interp, lexer);
+  double result = -1;
+  if (expect_token(interp, lexer, TOK_RPAREN)) {
+    int direction = arr->value.array.sorted &&
+                            arr->value.array.sorted_from <= from &&
+                            to <= arr->value.array.sorted_to
+                        ? arr->value.array.sorted
+                        : 0;
+    size_t n = to - from + 1;
+    long found = -1;
+    if (x.is_string != (arr->type == VAR_ARRAY_STRING))
+      interpreter_error(interp, "TYPE MISMATCH");
+    else if (x.is_string)
+      found = search_strings((char **)arr->value.array.data + from, n,
+                             x.string, direction);
+    else if (arr->type == VAR_ARRAY_INTEGER && fits_integer(x.number))
+      found = search_integers((int32_t *)arr->value.array.data + from, n,
+                              (int32_t)x.number, direction);
+    else if (arr->type != VAR_ARRAY_INTEGER)
+      found = search_numbers((double *)arr->value.array.data + from, n,
+                             x.number, direction);
+    if (found >= 0)
+      result = (double)(from + (size_t)found);
+  }
+  if (x.is_string)
+    safe_free(x.string);
+  return result;
+}
+
+/* Collect every DATA item of the program into the pool, once per run */
+bool data_build(Interpreter *interp) {
+  DataPool *pool = &interp->data;
+  if (pool->built)
+    return true;
+
+  Program *prog = &interp->program;
+  for (int i = 0; i < prog->count; i++) {
+    const uint8_t *code = program_line_code(interp, &prog->lines[i]);
+    size_t pos = 0, len;
+    const char *items;
+    while ((items = lexer_code_data(code, &pos, &len)) != NULL) {
+      if (!data_add(pool, prog->lines[i].line_number, items, len)) {
+        data_clear(pool);
+        interpreter_error(interp, "OUT OF MEMORY");
+        return false;
+      }
+    }
+  }
+  data_finish(pool);
+  return true;
+}
+
+static void read_statement(Interpreter *interp, Lexer *lexer) {
+  if (!data_build(interp))
+    return;
+
+  while (true) {
+    Target target;
+    if (!parse_target(interp, lexer, &target))
+      return;
+
+    const DataItem *item = data_read(&interp->data);
+    if (!item) {
+      interpreter_error(interp, "OUT OF DATA");
+    } else if (target.is_string) {
+      target_set_string(interp, &target, data_string(&interp->data, item));
+    } else if (item->is_number) {
+      target_set_number(interp, &target, item->number);
+    } else {
+      interpreter_error(interp, "TYPE MISMATCH");
+    }
+    target_free(&target);
+    if (interp->error_occurred)
+      return;
+
+    Token peek = lexer_peek_token(lexer);
+    bool more = peek.type == TOK_COMMA;
+    token_free(&peek);
+    if (!more)
+      return;
+    Token comma = lexer_next_token(lexer);
+    token_free(&comma);
+  }
+}
+
+static void restore_statement(Interpreter *interp, Lexer *lexer) {
+  if (!data_build(interp))
+    return;
+
+  Token peek = lexer_peek_token(lexer);
+  bool has_line = peek.type != TOK_EOF && peek.type != TOK_NEWLINE &&
+                  peek.type != TOK_COLON;
+  token_free(&peek);
+  if (!has_line) {
+    data_restore(&interp->data, 0);
+    return;
+  }
+
+  double line;
+  if (parse_numbers(interp, lexer, &line, 1, 1) < 0)
+    return;
+  if (!program_find_line(interp, (int)line)) {
+    interpreter_error(interp, "UNDEF'D STATEMENT");
+    return;
+  }
+  data_restore(&interp->data, (int)line);
+}
+
+static void jump_to(Interpreter *interp, ProgramLine *line) {
+  interp->current_line = line;
+  interp->jumped = true;
+}
+
+/* File I/O statements */
+/* Step over the rest of the current statement, up to ':' or end of line */
+static void skip_statement(Lexer *lexer) {
+  while (true) {
+    Token peek = lexer_peek_token(lexer);
+    bool end = peek.type == TOK_EOF || peek.type == TOK_NEWLINE ||
+               peek.type == TOK_COLON;
+    token_free(&peek);
+    if (end)
+      break;
+    Token item = lexer_next_token(lexer);
+    token_free(&item);
+  }
+}
+
+static void open_statement(Interpreter *interp, Lexer *lexer) {
+  double args[3] = {0, DEV_DISK, 0};
+  int count = parse_numbers(interp, lexer, args, 1, 3);
+  // Logical file, device and secondary address are bytes
+  if (count < 0 || !in_range(interp, args, count, 0, 255))
+    return;
+
+  char *name = NULL;
+  if (next_is_comma(lexer)) {
+    if (count < 3) {
+      interpreter_error(interp, "SYNTAX");
+      return;
+    }
+    Token comma = lexer_next_token(lexer);
+    token_free(&comma);
+    Value v = evaluate_expression(interp, lexer);
+    if (!v.is_string) {
+      interpreter_error(interp, "TYPE MISMATCH");
+      return;
+    }
+    name = v.string;
+  }
+
+  const char *err = chan_open(interp->channels, (int)args[0], (int)args[1],
+                              (int)args[2], name);
+  if (err)
+    interpreter_error(interp, err);
+  safe_free(name);
+}
+
+/* Parse "#lfn" and return its channel, checking the direction */
+static Channel *channel_arg(Interpreter *interp, Lexer *lexer, bool output) {
+  Token hash = lexer_next_token(lexer);
+  bool ok = hash.type == TOK_HASH;
+  token_free(&hash);
+  double lfn;
+  if (!ok) {
+    interpreter_error(interp, "SYNTAX");
+    return NULL;
+  }
+  if (parse_numbers(interp, lexer, &lfn, 1, 1) < 0 ||
+      !in_range(interp, &lfn, 1, 0, 255))
+    return NULL;
+
+  Channel *ch = chan_find(interp->channels, (int)lfn);
+  if (!ch)
+    interpreter_error(interp, "FILE NOT OPEN");
+  else if (ch->output != output)
+    interpreter_error(interp, output ? "NOT OUTPUT FILE" : "NOT INPUT FILE");
+  return interp->error_occurred ? NULL : ch;
+}
+
+static void channel_write(Interpreter *interp, Channel *ch, const char *data,
+                          size_t len) {
+  if (ch->device == DEV_SCREEN)
+    basic_write(interp, data, len);
+  else if (!chan_write(ch, data, len))
+    interpreter_error(interp, "CANNOT SAVE FILE");
+}
+
+/* PRINT#: like PRINT, but bytes go out untranslated and a trailing ; or ,
+ * suppresses the line ending */
+static void print_channel(Interpreter *interp, Lexer *lexer) {
+  Channel *ch = channel_arg(interp, lexer, true);
+  if (!ch)
+    return;
+  if (next_is_comma(lexer)) {
+    Token comma = lexer_next_token(lexer);
+    token_free(&comma);
+  }
+
+  bool newline = true;
+  while (!interp->error_occurred) {
+    Token peek = lexer_peek_token(lexer);
+    TokenType type = peek.type;
+    token_free(&peek);
+    if (type == TOK_EOF || type == TOK_NEWLINE || type == TOK_COLON)
+      break;
+    if (type == TOK_SEMICOLON || type == TOK_COMMA) {
+      Token sep = lexer_next_token(lexer);
+      token_free(&sep);
+      if (type == TOK_COMMA)
+        channel_write(interp, ch, "\t", 1);
+      newline = false;
+      continue;
+    }
+
+    newline = true;
+    Value v = evaluate_expression(interp, lexer);
+    if (v.is_string) {
+      channel_write(interp, ch, v.string, strlen(v.string));
+      safe_free(v.string);
+    } else {
+      char num[NUMBER_BUF_SIZE];
+      int len = format_number(num, v.number);
+      channel_write(interp, ch, num, (size_t)len);
+    }
+  }
+  if (newline && !interp->error_occurred)
+    channel_write(interp, ch, "\n", 1);
+}
+
+/* INPUT# and GET#: fill each listed variable from the channel. ST becomes
+ * 64 once the file is exhausted, as on the C64. */
+static void input_channel(Interpreter *interp, Lexer *lexer, bool get) {
+  Channel *ch = channel_arg(interp, lexer, false);
+  if (!ch)
+    return;
+
+  while (!interp->error_occurred) {
+    Token comma = lexer_next_token(lexer);
+    bool more = comma.type == TOK_COMMA;
+    token_free(&comma);
+    if (!more) {
+      interpreter_error(interp, "SYNTAX");
+      break;
+    }
+    Target target;
+    if (!parse_target(interp, lexer, &target))
+      break;
+
+    char byte[2] = {0, 0};
+    const char *field;
+    if (get) {
+      int c = chan_getc(ch);
+      byte[0] = c < 0 ? 0 : (char)c;
+      field = byte;
+    } else {
+      bool more;
+      field = chan_field(ch, &more);
+      if (!field)
+        field = "";
+    }
+
+    if (target.is_string) {
+      target_set_string(interp, &target, field);
+    } else if (get) {
+      target_set_number(interp, &target,
+                        isdigit((unsigned char)byte[0]) ? byte[0] - '0' : 0);
+    } else {
+      char *end;
+      double value = strtod(field, &end);
+      if (*end != '\0')
+        interpreter_error(interp, "FILE DATA");
+      else
+        target_set_number(interp, &target, value);
+    }
+    target_free(&target);
+
+    if (!next_is_comma(lexer))
+      break;
+  }
+  var_set_number(interp, "ST", chan_eof(ch) ? 64 : 0);
+}
+
+/* Where INPUT takes its fields from: a line picked off the editor screen,
+ * or the shared stdin reader, whose fields are split in its own buffer */
+typedef struct {
+  char *line; // Editor line being split
+  char *pos;
+  char *end;
+  bool more;    // Another field follows on the current line
+  bool started; // A line has been requested
+} InputSource;
+
+static char *input_field(Interpreter *interp, InputSource *in,
+                         const char *prompt) {
+  bool prompting = interp->editor || !interp->batch_input;
+  if (!in->more) {
+    char shown[256];
+    snprintf(shown, sizeof(shown), "%s? ", in->started ? "?" : prompt);
+    if (prompting)
+      basic_print(interp, "%s", shown);
+    in->started = true;
+
+    if (!interp->editor)
+      return chan_field(chan_stdin(), &in->more);
+
+    safe_free(in->line);
+    in->line = editor_read_line(interp->editor);
+    if (!in->line)
+      return NULL;
+    /* The picked screen line still starts with the prompt */
+    char *start = in->line;
+    const char *p = shown;
+    while (*p == ' ')
+      p++;
+    size_t len = strlen(p);
+    while (len > 0 && p[len - 1] == ' ')
+      len--;
+    if (strncmp(start, p, len) == 0)
+      start += len;
+    in->pos = start;
+    in->end = start + strlen(start);
+  } else if (!interp->editor) {
+    return chan_field(chan_stdin(), &in->more);
+  }
+  return field_split(&in->pos, in->end, &in->more);
+}
+
+/* Drop the rest of the current input line */
+static void input_skip(Interpreter *interp, InputSource *in) {
+  if (in->more && !interp->editor)
+    chan_line(chan_stdin());
+  in->more = false;
+}
+
+/* INPUT ["prompt";] var[, var...]: fields are converted straight from the
+ * input buffer. A non-numeric answer for a numeric variable asks again,
+ * as on the C64. At end of input ST becomes 64 and the variables keep
+ * their values; reading past that ends the program (returns false). */
+static bool input_statement(Interpreter *interp, Lexer *lexer) {
+  char *prompt = NULL;
+  if (next_is(lexer, TOK_STRING)) {
+    Token text = lexer_next_token(lexer);
+    prompt = text.text;
+    Token sep = lexer_next_token(lexer);
+    bool ok = sep.type == TOK_SEMICOLON || sep.type == TOK_COMMA;
+    token_free(&sep);
+    if (!ok) {
+      safe_free(prompt);
+      interpreter_error(interp, "SYNTAX");
+      return true;
+    }
+  }
+
+  bool got_input = true;
+  int vars_pos = lexer->position;
+  int vars_line = lexer->line;
+  int vars_col = lexer->column;
+  InputSource in = {NULL, NULL, NULL, false, false};
+
+  while (true) {
+    bool redo = false;
+    while (true) {
+      Target target;
+      if (!parse_target(interp, lexer, &target))
+        break;
+
+      char *field = input_field(interp, &in, prompt ? prompt : "");
+      if (!field) {
+        target_free(&target);
+        if (interp->input_eof)
+          interp->running = false;
+        interp->input_eof = true;
+        got_input = false;
+        skip_statement(lexer);
+        break;
+      }
+
+      if (target.is_string) {
+        target_set_string(interp, &target, field);
+      } else {
+        char *end;
+        double value = strtod(field, &end);
+        while (*end == ' ')
+          end++;
+        if (*end != '\0')
+          redo = true;
+        else
+          target_set_number(interp, &target, value);
+      }
+      target_free(&target);
+      if (interp->error_occurred || redo || !next_is_comma(lexer))
+        break;
+      Token comma = lexer_next_token(lexer);
+      token_free(&comma);
+    }
+
+    if (!redo || interp->error_occurred)
+      break;
+    basic_print(interp, "?REDO FROM START\n");
+    input_skip(interp, &in);
+    in.started = false;
+    lexer->position = vars_pos;
+    lexer->line = vars_line;
+    lexer->column = vars_col;
+  }
+
+  if (in.more && got_input && !interp->error_occurred) {
+    if (interp->editor || !interp->batch_input)
+      basic_print(interp, "?EXTRA IGNORED\n");
+    input_skip(interp, &in);
+  }
+  safe_free(in.line);
+  safe_free(prompt);
+  var_set_number(interp, "ST", got_input ? 0 : 64);
+  return got_input || interp->running;
+}
+
+static void close_statement(Interpreter *interp, Lexer *lexer) {
+  double lfn;
+  if (parse_numbers(interp, lexer, &lfn, 1, 1) < 0 ||
+      !in_range(interp, &lfn, 1, 0, 255))
+    return;
+  /* Closing a file that isn't open is not an error on the C64 */
+  Channel *ch = chan_find(interp->channels, (int)lfn);
+  if (ch) {
+    bool ok = !ch->output || chan_flush(ch);
+    chan_close(ch);
+    if (!ok)
+      interpreter_error(interp, "CANNOT SAVE FILE");
+  }
+}
+
+/* Filename argument of BLOAD/BSAVE, followed by the comma before the
+ * address. Returns an owned string or NULL after an error. */
+static char *block_file_arg(Interpreter *interp, Lexer *lexer) {
+  Value v = evaluate_expression(interp, lexer);
+  if (!v.is_string) {
+    interpreter_error(interp, "TYPE MISMATCH");
+    return NULL;
+  }
+  Token comma = lexer_next_token(lexer);
+  bool ok = comma.type == TOK_COMMA;
+  token_free(&comma);
+  if (!ok) {
+    safe_free(v.string);
+    interpreter_error(interp, "SYNTAX");
+    return NULL;
+  }
+  return v.string;
+}
+
+/* BLOAD "file",start: the whole file lands in memory at start */
+static void bload_statement(Interpreter *interp, Lexer *lexer) {
+  char *name = block_file_arg(interp, lexer);
+  double start;
+  if (!name)
+    return;
+  if (parse_numbers(interp, lexer, &start, 1, 1) < 0) {
+    safe_free(name);
+    return;
+  }
+
+  size_t size;
+  const void *data = file_map(name, &size);
+  safe_free(name);
+  if (!data)
+    interpreter_error(interp, "FILE NOT FOUND");
+  else if (start < 0 || start >= RAM_SIZE)
+    interpreter_error(interp, "ILLEGAL QUANTITY");
+  else if (size > RAM_SIZE - (size_t)start)
+    interpreter_error(interp, "OUT OF MEMORY");
+  else
+    mem_write_block(interp, (uint16_t)start, data, size);
+  file_unmap(data, size);
+}
+
+/* BSAVE "file",start TO end: bytes start..end-1, as on the C128 */
+static void bsave_statement(Interpreter *interp, Lexer *lexer) {
+  char *name = block_file_arg(interp, lexer);
+  double range[2];
+  if (!name)
+    return;
+  if (parse_numbers(interp, lexer, &range[0], 1, 1) < 0) {
+    safe_free(name);
+    return;
+  }
+  Token to = lexer_next_token(lexer);
+  bool ok = to.type == TOK_TO;
+  token_free(&to);
+  if (!ok)
+    interpreter_error(interp, "SYNTAX");
+  if (!ok || parse_numbers(interp, lexer, &range[1], 1, 1) < 0) {
+    safe_free(name);
+    return;
+  }
+  if (range[0] < 0 || range[1] > RAM_SIZE || range[0] > range[1]) {
+    safe_free(name);
+    interpreter_error(interp, "ILLEGAL QUANTITY");
+    return;
+  }
+
+  FILE *file = fopen(name, "wb");
+  safe_free(name);
+  if (!file) {
+    interpreter_error(interp, "CANNOT SAVE FILE");
+    return;
+  }
+  size_t addr = (size_t)range[0], end = (size_t)range[1];
+  while (ok && addr < end) {
+    uint8_t chunk[4096];
+    size_t len = end - addr < sizeof(chunk) ? end - addr : sizeof(chunk);
+    mem_read_block(interp, (uint16_t)addr, chunk, len);
+    ok = fwrite(chunk, 1, len, file) == len;
+    addr += len;
+  }
+  if (fclose(file) != 0 || !ok)
+    interpreter_error(interp, "CANNOT SAVE FILE");
+}
+
+/* SNAPSHOT "file": a running program resumes after this statement */
+static void snapshot_statement(Interpreter *interp, Lexer *lexer) {
+  Value v = evaluate_expression(interp, lexer);
+  if (!v.is_string) {
+    interpreter_error(interp, "TYPE MISMATCH");
+    return;
+  }
+  bool resumable = interp->running && interp->current_line;
+  if (!snapshot_save(interp, v.string,
+                     resumable ? interp->current_line->line_number
+                               : SNAPSHOT_NO_LINE,
+                     resumable ? (size_t)lexer->position : 0))
+    interpreter_error(interp, "CANNOT SAVE FILE");
+  safe_free(v.string);
+}
+
+static void clear_display(Interpreter *interp) {
+  gfx_clear(&interp->bitmap);
+  mem_discard_screen(interp);
+  if (interp->editor) {
+    editor_clear(interp->editor);
+  } else if (!interp->headless) {
+    clear_screen();
+  }
+}
+
+static void execute_statements(Interpreter *interp, Lexer *lexer);
+
+/* Direct mode lines are tokenized and typed like program lines, so the
+ * evaluator only ever sees compiled code */
 void interpreter_execute_line(Interpreter *interp, const char *line) {
+  size_t length;
+  uint8_t *code = lexer_tokenize(line, &length);
+  if (!code) {
+    interpreter_error(interp, "OUT OF MEMORY");
+    return;
+  }
+  if (compile_code(code))
+    interpreter_execute_code(interp, code);
+  else
+    interpreter_error(interp, "TYPE MISMATCH");
+  safe_free(code);
+}
+
+void interpreter_execute_code(Interpreter *interp, const uint8_t *code) {
   Lexer lexer;
-  lexer_init(&lexer, line);
+  lexer_init_code(&lexer, code);
+  execute_statements(interp, &lexer);
+  lexer_free(&lexer);
+}
 
+static void execute_statements(Interpreter *interp, Lexer *lexer) {
   while (true) {
-    Token token = lexer_next_token(&lexer);
+    Token token = lexer_next_token(lexer);
 
     if (token.type == TOK_EOF || token.type == TOK_NEWLINE) {
       token_free(&token);
       break;
     }
 
-    if (token.type == TOK_PRINT || token.type == TOK_QUESTION) {
+    if ((token.type == TOK_PRINT || token.type == TOK_INPUT ||
+         token.type == TOK_GET) &&
+        next_is_hash(lexer)) {
+      TokenType type = token.type;
+      token_free(&token);
+      if (type == TOK_PRINT)
+        print_channel(interp, lexer);
+      else
+        input_channel(interp, lexer, type == TOK_GET);
+    } else if (token.type == TOK_PRINT || token.type == TOK_QUESTION) {
       token_free(&token);
       while (true) {
-        Token peek = lexer_peek_token(&lexer);
+        Token peek = lexer_peek_token(lexer);
         if (peek.type == TOK_EOF || peek.type == TOK_NEWLINE ||
             peek.type == TOK_COLON) {
           basic_print(interp, "\n");
@@ -590,15 +2702,24 @@ void interpreter_execute_line(Interpreter *interp, const char *line) {
         }
         token_free(&peek);
 
-        Value v = evaluate_expression(interp, &lexer);
-        if (v.is_string) {
+        Value v = evaluate_expression(interp, lexer);
+        if (interp->error_occurred) {
+          if (v.is_string)
+            safe_free(v.string);
+          break;
+        }
+        if (v.is_string && interp->headless) {
+          /* No terminal to drive: pass the bytes through untranslated */
+          basic_write(interp, v.string, strlen(v.string));
+          safe_free(v.string);
+        } else if (v.is_string) {
           /* Handle some CBM control characters */
           if (v.string) {
             for (char *p = v.string; *p; p++) {
               unsigned char c = (unsigned char)*p;
               if (interp->editor) {
                 if (c == 147) { // CLR/HOME
-                  editor_clear(interp->editor);
+                  clear_display(interp);
                 } else if (c == 19) { // HOME
                   editor_move_cursor(interp->editor, 0, 0);
                 } else if (c == 17) { // CSR DOWN
@@ -635,15 +2756,17 @@ void interpreter_execute_line(Interpreter *interp, const char *line) {
           }
           safe_free(v.string);
         } else {
-          basic_print(interp, "%g", v.number);
+          char num[NUMBER_BUF_SIZE];
+          int len = format_number(num, v.number);
+          basic_write(interp, num, (size_t)len);
         }
 
-        peek = lexer_peek_token(&lexer);
+        peek = lexer_peek_token(lexer);
         if (peek.type == TOK_SEMICOLON) {
-          lexer_next_token(&lexer);
+          lexer_next_token(lexer);
           token_free(&peek);
         } else if (peek.type == TOK_COMMA) {
-          lexer_next_token(&lexer);
+          lexer_next_token(lexer);
           token_free(&peek);
           basic_print(interp, "\t");
         } else {
@@ -654,20 +2777,20 @@ void interpreter_execute_line(Interpreter *interp, const char *line) {
       }
     } else if (token.type == TOK_IF) {
       token_free(&token);
-      Value cond = evaluate_expression(interp, &lexer);
-      Token then_tok = lexer_next_token(&lexer);
+      Value cond = evaluate_expression(interp, lexer);
+      Token then_tok = lexer_next_token(lexer);
 
       if (then_tok.type == TOK_THEN) {
         if (cond.number != 0) {
           /* THEN branch */
-          Token peek = lexer_peek_token(&lexer);
+          Token peek = lexer_peek_token(lexer);
           if (peek.type == TOK_NUMBER) {
             /* IF...THEN [line] */
-            lexer_next_token(&lexer); // consume number
+            lexer_next_token(lexer); // consume number
             ProgramLine *target =
                 program_find_line(interp, (int)peek.number_value);
             if (target) {
-              interp->current_line = target;
+              jump_to(interp, target);
               // Important: break the token loop so we don't execute rest of
               // this line
               token_free(&peek);
@@ -683,7 +2806,7 @@ void interpreter_execute_line(Interpreter *interp, const char *line) {
         } else {
           /* Skip to ELSE or end of line */
           while (true) {
-            token = lexer_next_token(&lexer);
+            token = lexer_next_token(lexer);
             if (token.type == TOK_EOF || token.type == TOK_NEWLINE)
               break;
             if (token.type == TOK_ELSE)
@@ -697,11 +2820,11 @@ void interpreter_execute_line(Interpreter *interp, const char *line) {
         safe_free(cond.string);
     } else if (token.type == TOK_GOTO) {
       token_free(&token);
-      Value v = evaluate_expression(interp, &lexer);
+      Value v = evaluate_expression(interp, lexer);
       if (!v.is_string) {
         ProgramLine *target = program_find_line(interp, (int)v.number);
         if (target) {
-          interp->current_line = target;
+          jump_to(interp, target);
         } else {
           interpreter_error(interp, "LINE NOT FOUND");
         }
@@ -710,14 +2833,14 @@ void interpreter_execute_line(Interpreter *interp, const char *line) {
         safe_free(v.string);
     } else if (token.type == TOK_GOSUB) {
       token_free(&token);
-      Value v = evaluate_expression(interp, &lexer);
+      Value v = evaluate_expression(interp, lexer);
       if (!v.is_string) {
         ProgramLine *target = program_find_line(interp, (int)v.number);
         if (target) {
           if (interp->current_line) {
             stack_push(interp, interp->current_line->line_number);
           }
-          interp->current_line = target;
+          jump_to(interp, target);
         } else {
           interpreter_error(interp, "LINE NOT FOUND");
         }
@@ -730,102 +2853,106 @@ void interpreter_execute_line(Interpreter *interp, const char *line) {
       if (!interp->error_occurred) {
         ProgramLine *target = program_find_line(interp, return_line);
         if (target) {
-          interp->current_line = target->next;
+          jump_to(interp, program_next_line(interp, target));
         } else {
           // If the line was deleted, find the next one
           // This is a bit complex, but standard BASIC behavior is usually
           // to error or jump to next available.
           // For now, let's just find the first line > return_line.
-          ProgramLine *curr = interp->program;
-          while (curr && curr->line_number <= return_line) {
-            curr = curr->next;
-          }
-          interp->current_line = curr;
+          Program *prog = &interp->program;
+          int next = program_lower_bound(prog, return_line + 1);
+          jump_to(interp, next < prog->count ? &prog->lines[next] : NULL);
         }
       }
     } else if (token.type == TOK_LET || token.type == TOK_IDENTIFIER) {
-      char *name = NULL;
-      if (token.type == TOK_IDENTIFIER) {
-        name = str_duplicate(token.text);
-      } else {
+      Target target;
+      bool ok;
+      if (token.type == TOK_LET) {
         token_free(&token);
-        token = lexer_next_token(&lexer);
-        if (token.type == TOK_IDENTIFIER) {
-          name = str_duplicate(token.text);
-        }
+        ok = parse_target(interp, lexer, &target);
+      } else {
+        ok = target_init(interp, lexer, token.text, &target);
       }
-      token_free(&token);
-
-      if (name) {
-        Token eq = lexer_next_token(&lexer);
-        if (eq.type == TOK_EQUAL) {
-          Value v = evaluate_expression(interp, &lexer);
-          if (v.is_string) {
-            var_set_string(interp, name, v.string);
-            safe_free(v.string);
-          } else {
-            var_set_number(interp, name, v.number);
-          }
+      if (!ok)
+        break;
+      Token eq = lexer_next_token(lexer);
+      if (eq.type == TOK_EQUAL) {
+        Value v = evaluate_expression(interp, lexer);
+        if (v.is_string) {
+          target_set_string(interp, &target, v.string);
+          safe_free(v.string);
+        } else if (v.is_integer) {
+          target_set_integer(interp, &target, v.integer);
         } else {
-          interpreter_error(interp, "SYNTAX");
+          target_set_number(interp, &target, v.number);
         }
-        token_free(&eq);
-        safe_free(name);
+      } else {
+        interpreter_error(interp, "SYNTAX");
       }
+      token_free(&eq);
+      target_free(&target);
     } else if (token.type == TOK_POKE) {
       token_free(&token);
-      Value addr = evaluate_expression(interp, &lexer);
-      Token comma = lexer_next_token(&lexer);
-      token_free(&comma);
-      Value val = evaluate_expression(interp, &lexer);
-
-      if (!addr.is_string && !val.is_string) {
-        uint16_t a = (uint16_t)addr.number;
-        uint8_t v = (uint8_t)val.number;
-        interp->ram[a] = v;
-
-        if (interp->editor) {
-          if (a == 53280 || a == 53281) {
-            editor_set_background_color(interp->editor, v);
-          } else if (a >= 1024 && a <= 2023) {
-            editor_poke_char(interp->editor, a, v);
-          }
-        }
-      }
-      if (addr.is_string)
-        safe_free(addr.string);
-      if (val.is_string)
-        safe_free(val.string);
+      double a[2];
+      if (parse_numbers(interp, lexer, a, 2, 2) > 0 &&
+          in_range(interp, &a[0], 1, 0, RAM_SIZE - 1) &&
+          in_range(interp, &a[1], 1, 0, 255))
+        mem_poke(interp, (uint16_t)a[0], (uint8_t)a[1]);
     } else if (token.type == TOK_PLOT) {
       token_free(&token);
-      Value vx = evaluate_expression(interp, &lexer);
-      Token comma = lexer_next_token(&lexer);
-      token_free(&comma);
-      Value vy = evaluate_expression(interp, &lexer);
-      if (!vx.is_string && !vy.is_string) {
-        interp->graphics_x = vx.number;
-        interp->graphics_y = vy.number;
+      double a[2];
+      if (parse_numbers(interp, lexer, a, 2, 2) > 0 &&
+          in_range(interp, a, 2, -GFX_COORD_MAX, GFX_COORD_MAX)) {
+        interp->graphics_x = a[0];
+        interp->graphics_y = a[1];
       }
-      if (vx.is_string)
-        safe_free(vx.string);
-      if (vy.is_string)
-        safe_free(vy.string);
     } else if (token.type == TOK_DRAW) {
       token_free(&token);
-      Value vx = evaluate_expression(interp, &lexer);
-      Token comma = lexer_next_token(&lexer);
-      token_free(&comma);
-      Value vy = evaluate_expression(interp, &lexer);
-      if (!vx.is_string && !vy.is_string) {
+      double a[2];
+      if (parse_numbers(interp, lexer, a, 2, 2) > 0 &&
+          in_range(interp, a, 2, -GFX_COORD_MAX, GFX_COORD_MAX)) {
         draw_line(interp, (int)interp->graphics_x, (int)interp->graphics_y,
-                  (int)vx.number, (int)vy.number);
-        interp->graphics_x = vx.number;
-        interp->graphics_y = vy.number;
+                  (int)a[0], (int)a[1]);
+        interp->graphics_x = a[0];
+        interp->graphics_y = a[1];
+      }
+    } else if (token.type == TOK_BOX) {
+      /* BOX x1,y1,x2,y2[,fill] */
+      token_free(&token);
+      double a[5];
+      int n = parse_numbers(interp, lexer, a, 4, 5);
+      if (n > 0 && in_range(interp, a, 4, -GFX_COORD_MAX, GFX_COORD_MAX)) {
+        gfx_box(&interp->bitmap, (int)a[0], (int)a[1], (int)a[2], (int)a[3],
+                n == 5 && a[4] != 0);
+        if (interp->editor)
+          gfx_render(&interp->bitmap, interp->editor);
+        interp->graphics_x = a[2];
+        interp->graphics_y = a[3];
+      }
+    } else if (token.type == TOK_CIRCLE) {
+      /* CIRCLE x,y,r */
+      token_free(&token);
+      double a[3];
+      if (parse_numbers(interp, lexer, a, 3, 3) > 0 &&
+          in_range(interp, a, 3, -GFX_COORD_MAX, GFX_COORD_MAX)) {
+        gfx_circle(&interp->bitmap, (int)a[0], (int)a[1], (int)a[2]);
+        if (interp->editor)
+          gfx_render(&interp->bitmap, interp->editor);
+        interp->graphics_x = a[0];
+        interp->graphics_y = a[1];
+      }
+    } else if (token.type == TOK_PAINT) {
+      /* PAINT x,y */
+      token_free(&token);
+      double a[2];
+      if (parse_numbers(interp, lexer, a, 2, 2) > 0 &&
+          in_range(interp, a, 2, -GFX_COORD_MAX, GFX_COORD_MAX)) {
+        gfx_paint(&interp->bitmap, (int)a[0], (int)a[1]);
+        if (interp->editor)
+          gfx_render(&interp->bitmap, interp->editor);
+        interp->graphics_x = a[0];
+        interp->graphics_y = a[1];
       }
-      if (vx.is_string)
-        safe_free(vx.string);
-      if (vy.is_string)
-        safe_free(vy.string);
     } else if (token.type == TOK_EXIT) {
       interp->exit_requested = true;
       interp->running = false;
@@ -839,11 +2966,7 @@ void interpreter_execute_line(Interpreter *interp, const char *line) {
       token_free(&token);
       continue;
     } else if (token.type == TOK_CLR) {
-      if (interp->editor) {
-        editor_clear(interp->editor);
-      } else {
-        clear_screen();
-      }
+      clear_display(interp);
       token_free(&token);
     } else if (token.type == TOK_MEMCHK) {
       char mem_buf[256];
@@ -856,6 +2979,47 @@ void interpreter_execute_line(Interpreter *interp, const char *line) {
     } else if (token.type == TOK_REM) {
       token_free(&token);
       break;
+    } else if (token.type == TOK_DATA) {
+      /* Items are taken from the data pool by READ; skip them here */
+      token_free(&token);
+      skip_statement(lexer);
+    } else if (token.type == TOK_INPUT) {
+      token_free(&token);
+      if (!input_statement(interp, lexer))
+        break;
+    } else if (token.type == TOK_OPEN) {
+      token_free(&token);
+      open_statement(interp, lexer);
+    } else if (token.type == TOK_CLOSE) {
+      token_free(&token);
+      close_statement(interp, lexer);
+    } else if (token.type == TOK_BLOAD) {
+      token_free(&token);
+      bload_statement(interp, lexer);
+    } else if (token.type == TOK_BSAVE) {
+      token_free(&token);
+      bsave_statement(interp, lexer);
+    } else if (token.type == TOK_DELETE) {
+      token_free(&token);
+      delete_statement(interp, lexer);
+    } else if (token.type == TOK_SORT) {
+      token_free(&token);
+      sort_statement(interp, lexer);
+    } else if (token.type == TOK_MAT) {
+      token_free(&token);
+      mat_statement(interp, lexer);
+    } else if (token.type == TOK_DIM) {
+      token_free(&token);
+      dim_statement(interp, lexer);
+    } else if (token.type == TOK_SNAPSHOT) {
+      token_free(&token);
+      snapshot_statement(interp, lexer);
+    } else if (token.type == TOK_READ) {
+      token_free(&token);
+      read_statement(interp, lexer);
+    } else if (token.type == TOK_RESTORE) {
+      token_free(&token);
+      restore_statement(interp, lexer);
     } else {
       interpreter_error(interp, "SYNTAX");
       token_free(&token);
@@ -865,6 +3029,4 @@ void interpreter_execute_line(Interpreter *interp, const char *line) {
     if (interp->error_occurred)
       break;
   }
-
-  lexer_free(&lexer);
 }
@@ -5,8 +5,14 @@
 #include <math.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 
+#include "data.h"
 #include "editor.h"
+#include "fileio.h"
+#include "graphics.h"
+#include "hashmap.h"
+#include "rng.h"
 
 /* Forward declarations */
 typedef struct Variable Variable;
@@ -17,8 +23,12 @@ typedef struct Interpreter Interpreter;
 typedef enum {
   VAR_NUMBER,
   VAR_STRING,
+  VAR_INTEGER, // Name ends in %
   VAR_ARRAY_NUMBER,
-  VAR_ARRAY_STRING
+  VAR_ARRAY_STRING,
+  VAR_ARRAY_INTEGER,
+  VAR_MAP_NUMBER,
+  VAR_MAP_STRING
 } VarType;
 
 /* Variable structure */
@@ -28,22 +38,46 @@ typedef struct Variable {
   union {
     double number;
     char *string;
+    int32_t integer;
     struct {
+      /* Row-major: double[], int32_t[] or char *[] (NULL reads as "") */
       void *data;
-      int *dimensions;
+      int *dimensions; // Extent of each dimension (DIM bound + 1)
+      int *strides;    // Elements per step in each dimension; last is 1
       int dim_count;
+      size_t count;       // Total elements
+      int sorted;         // 1 or -1: elements sorted_from..sorted_to are in
+      size_t sorted_from; // ascending or descending order (set by SORT,
+      size_t sorted_to;   // cleared by any store into the array)
     } array;
+    HashMap map; // H{} or H${}
   } value;
   struct Variable *next;
 } Variable;
 
-/* Program line structure */
+#define MAX_LINE_NUMBER 63999 // As on the C64
+
+/* Program line: text and code are offsets into the program arena */
 typedef struct ProgramLine {
   int line_number;
-  char *text;
-  struct ProgramLine *next;
+  uint32_t text; /* UINT32_MAX until needed for lines loaded pre-tokenized */
+  uint32_t code; /* Pre-tokenized form executed by RUN */
+  uint32_t code_len;
 } ProgramLine;
 
+/* Program storage: lines sorted by number in one array, their bytes in one
+ * arena. Garbage left by edits is compacted away once it dominates. */
+typedef struct Program {
+  ProgramLine *lines;
+  int count;
+  int capacity;
+  uint8_t *arena;
+  size_t arena_used;
+  size_t arena_size;
+  size_t arena_garbage;
+  bool compiled; // Every line typed by compile_code since the last edit
+} Program;
+
 /* Stack frame for GOSUB/RETURN */
 typedef struct StackFrame {
   int return_line;
@@ -59,10 +93,25 @@ typedef struct ForLoop {
   struct ForLoop *next;
 } ForLoop;
 
+#define RAM_SIZE 65536
+
+/* Memory-mapped I/O: each 256-byte page of `ram` is either plain RAM (no
+ * handlers) or routed through read/write handlers. See memmap.c. */
+typedef uint8_t (*MemReadFn)(Interpreter *interp, uint16_t addr);
+typedef void (*MemWriteFn)(Interpreter *interp, uint16_t addr, uint8_t val);
+
+typedef struct MemPage {
+  MemReadFn read;   // NULL: read ram[] directly
+  MemWriteFn write; // NULL: write ram[] directly
+} MemPage;
+
 /* Interpreter state */
 typedef struct Interpreter {
-  ProgramLine *program;
+  Program program;
   ProgramLine *current_line;
+  bool jumped; // current_line was set by GOTO/GOSUB/RETURN/THEN
+  DataPool data; // DATA items, built on the first READ/RESTORE of a run
+  Channel channels[MAX_CHANNELS]; // Files opened with OPEN
   Variable *variables;
   StackFrame *call_stack;
   ForLoop *for_stack;
@@ -71,9 +120,18 @@ typedef struct Interpreter {
   bool break_requested;
   bool exit_requested;
   bool error_occurred;
+  bool headless;      // stdout is not a terminal: stream plain bytes
+  bool batch_input;   // stdin is not a terminal: INPUT reads without prompts
+  bool input_eof;     // INPUT has already reported end of input this run
   double graphics_x;  // Current graphics X position
   double graphics_y;  // Current graphics Y position
-  uint8_t ram[65536]; // C64-style 64KB RAM
+  Rng rng;            // RND's generator
+  Bitmap bitmap;      // 320x200 hi-res framebuffer behind PLOT/DRAW
+  uint8_t *ram;       // C64-style 64KB RAM: ram_store or a mapped image
+  bool ram_mapped;    // ram is a shared mapping of a RAM image file
+  uint8_t ram_store[RAM_SIZE];
+  MemPage pages[256]; // I/O dispatch per 256-byte page of ram
+  bool screen_pending; // Screen RAM cells not yet on the terminal
   char *error_message;
 } Interpreter;
 
@@ -81,16 +139,31 @@ typedef struct Interpreter {
 void interpreter_init(Interpreter *interp);
 void interpreter_free(Interpreter *interp);
 void interpreter_run(Interpreter *interp);
+/* Continue a program `offset` bytes into the code of line_number, without
+ * the reset RUN does; used to resume a restored snapshot */
+void interpreter_resume(Interpreter *interp, int line_number, size_t offset);
 void interpreter_execute_line(Interpreter *interp, const char *line);
+void interpreter_execute_code(Interpreter *interp, const uint8_t *code);
 void interpreter_list(Interpreter *interp, int start, int end);
 void interpreter_new(Interpreter *interp);
 bool interpreter_load(Interpreter *interp, const char *filename);
 bool interpreter_save(Interpreter *interp, const char *filename);
+bool interpreter_save_binary(Interpreter *interp, const char *filename);
+#define BINARY_VERSION 2 // Layout of pre-tokenized images
+bool interpreter_load_image(Interpreter *interp, const void *src,
+                            size_t size);
+bool interpreter_write_binary(Interpreter *interp, FILE *file);
+bool interpreter_is_binary(const void *src, size_t size);
+
+/* Fill the DATA pool from the program if this run has not yet */
+bool data_build(Interpreter *interp);
 
 /* Program management */
 void program_add_line(Interpreter *interp, int line_num, const char *text);
 void program_delete_line(Interpreter *interp, int line_num);
 ProgramLine *program_find_line(Interpreter *interp, int line_num);
+ProgramLine *program_next_line(Interpreter *interp, ProgramLine *line);
+const uint8_t *program_line_code(Interpreter *interp, ProgramLine *line);
 void program_clear(Interpreter *interp);
 
 /* Variable management */
@@ -98,8 +171,23 @@ Variable *var_get(Interpreter *interp, const char *name);
 Variable *var_set_number(Interpreter *interp, const char *name, double value);
 Variable *var_set_string(Interpreter *interp, const char *name,
                          const char *value);
+Variable *var_set_integer(Interpreter *interp, const char *name,
+                          int32_t value);
 void var_clear_all(Interpreter *interp);
 
+/* Arrays live apart from scalars, so A and A() are different variables */
+#define ARRAY_MAX_DIMS 8
+#define ARRAY_AUTO_BOUND 10 // Extent of an array used without DIM is 11
+Variable *array_get(Interpreter *interp, const char *name);
+/* Allocate a zeroed array with the given extents; NULL after an error */
+Variable *array_create(Interpreter *interp, const char *name,
+                       const int *dimensions, int dim_count);
+
+/* Keyed collections are a third namespace: H, H() and H{} all differ */
+Variable *map_get(Interpreter *interp, const char *name);
+/* Add an empty map; NULL after an error */
+Variable *map_create(Interpreter *interp, const char *name);
+
 /* Stack management */
 void stack_push(Interpreter *interp, int return_line);
 int stack_pop(Interpreter *interp);
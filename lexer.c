@@ -1,6 +1,8 @@
 #include "lexer.h"
+#include "numfmt.h"
 #include "utils.h"
 #include <ctype.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -30,10 +32,27 @@ static KeywordMapping keywords[] = {
     {"TAN", TOK_TAN},         {"SQR", TOK_SQR},       {"LEN", TOK_LEN},
     {"LEFT$", TOK_LEFT},      {"RIGHT$", TOK_RIGHT},  {"MID$", TOK_MID},
     {"STR$", TOK_STR},        {"VAL", TOK_VAL},       {"CHR$", TOK_CHR},
-    {"PEEK", TOK_PEEK},       {"ASC", TOK_ASC},       {NULL, TOK_ERROR}};
+    {"PEEK", TOK_PEEK},       {"ASC", TOK_ASC},       {"BOX", TOK_BOX},
+    {"CIRCLE", TOK_CIRCLE},   {"PAINT", TOK_PAINT},   {"OPEN", TOK_OPEN},
+    {"CLOSE", TOK_CLOSE},     {"GET", TOK_GET},       {"BLOAD", TOK_BLOAD},
+    {"BSAVE", TOK_BSAVE},     {"SNAPSHOT", TOK_SNAPSHOT},
+    {"MAT", TOK_MAT},         {"SORT", TOK_SORT},     {"SEARCH", TOK_SEARCH},
+    {"DELETE", TOK_DELETE},   {"EXISTS", TOK_EXISTS}, {"KEY$", TOK_KEY},
+    {NULL, TOK_ERROR}};
+
+/* Pre-tokenized line encoding */
+#define CODE_END 0x00
+#define CODE_NUMBER 0x01 /* 8-byte double */
+#define CODE_STRING 0x02 /* u32 length + bytes */
+#define CODE_IDENT 0x03  /* u16 length + bytes */
+#define CODE_CHAR 0x04   /* unrecognised source character */
+#define CODE_TEXT 0x05   /* u32 length + bytes: REM comment, not executed */
+#define CODE_DATA 0x06   /* u32 length + bytes: DATA items, skipped by RUN */
+#define CODE_TOKEN 0x80  /* 0x80 + TokenType */
 
 void lexer_init(Lexer *lexer, const char *input) {
   lexer->input = input;
+  lexer->code = NULL;
   lexer->position = 0;
   lexer->line = 1;
   lexer->column = 1;
@@ -41,6 +60,11 @@ void lexer_init(Lexer *lexer, const char *input) {
   lexer->current_token.text = NULL;
 }
 
+void lexer_init_code(Lexer *lexer, const uint8_t *code) {
+  lexer_init(lexer, "");
+  lexer->code = code;
+}
+
 void lexer_free(Lexer *lexer) {
   if (lexer->current_token.text) {
     safe_free(lexer->current_token.text);
@@ -160,7 +184,7 @@ static Token read_identifier(Lexer *lexer) {
   int col = lexer->column;
 
   while (isalnum(peek_char(lexer)) || peek_char(lexer) == '_' ||
-         peek_char(lexer) == '$') {
+         peek_char(lexer) == '$' || peek_char(lexer) == '%') {
     next_char(lexer);
   }
 
@@ -188,7 +212,65 @@ static Token read_identifier(Lexer *lexer) {
   return token;
 }
 
+static uint32_t read_u32(const uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+         ((uint32_t)p[3] << 24);
+}
+
+static Token make_text_token(TokenType type, const uint8_t *text, size_t len,
+                             int col) {
+  Token token = make_token(type, NULL, 0, 1, col);
+  token.text = safe_malloc(len + 1);
+  if (token.text) {
+    memcpy(token.text, text, len);
+    token.text[len] = '\0';
+  }
+  return token;
+}
+
+/* Decode the next token of a pre-tokenized line: no scanning, no keyword
+ * lookup, no number conversion */
+static Token next_code_token(Lexer *lexer) {
+  const uint8_t *p = lexer->code + lexer->position;
+  int col = lexer->position;
+
+  switch (*p) {
+  case CODE_END:
+  case CODE_TEXT:
+    return make_token(TOK_EOF, NULL, 0, 1, col);
+  case CODE_NUMBER: {
+    double value;
+    memcpy(&value, p + 1, sizeof(value));
+    lexer->position += 1 + sizeof(value);
+    return make_token(TOK_NUMBER, NULL, value, 1, col);
+  }
+  case CODE_DATA:
+    /* READ takes items from the data pool; execution steps over them */
+    lexer->position += 5 + read_u32(p + 1);
+    return next_code_token(lexer);
+  case CODE_STRING: {
+    uint32_t len = read_u32(p + 1);
+    lexer->position += 5 + len;
+    return make_text_token(TOK_STRING, p + 5, len, col);
+  }
+  case CODE_IDENT: {
+    size_t len = p[1] | (p[2] << 8);
+    lexer->position += 3 + len;
+    return make_text_token(TOK_IDENTIFIER, p + 3, len, col);
+  }
+  case CODE_CHAR:
+    lexer->position += 2;
+    return make_token(TOK_ERROR, NULL, 0, 1, col);
+  default:
+    lexer->position++;
+    return make_token((TokenType)(*p - CODE_TOKEN), NULL, 0, 1, col);
+  }
+}
+
 Token lexer_next_token(Lexer *lexer) {
+  if (lexer->code)
+    return next_code_token(lexer);
+
   skip_whitespace(lexer);
 
   char c = peek_char(lexer);
@@ -245,6 +327,12 @@ Token lexer_next_token(Lexer *lexer) {
     return make_token(TOK_COLON, ":", 0, line, col);
   case '?':
     return make_token(TOK_QUESTION, "?", 0, line, col);
+  case '#':
+    return make_token(TOK_HASH, "#", 0, line, col);
+  case '{':
+    return make_token(TOK_LBRACE, "{", 0, line, col);
+  case '}':
+    return make_token(TOK_RBRACE, "}", 0, line, col);
   case '=':
     return make_token(TOK_EQUAL, "=", 0, line, col);
   case '<':
@@ -278,6 +366,363 @@ Token lexer_peek_token(Lexer *lexer) {
   return token;
 }
 
+TokenType lexer_peek_type(Lexer *lexer) {
+  if (lexer->code) {
+    switch (lexer->code[lexer->position]) {
+    case CODE_END:
+    case CODE_TEXT:
+      return TOK_EOF;
+    case CODE_NUMBER:
+      return TOK_NUMBER;
+    case CODE_STRING:
+      return TOK_STRING;
+    case CODE_IDENT:
+      return TOK_IDENTIFIER;
+    case CODE_CHAR:
+      return TOK_ERROR;
+    case CODE_DATA:
+      break; // Stepped over by next_code_token
+    default:
+      return (TokenType)(lexer->code[lexer->position] - CODE_TOKEN);
+    }
+  }
+  Token peek = lexer_peek_token(lexer);
+  TokenType type = peek.type;
+  token_free(&peek);
+  return type;
+}
+
+/* Growable byte buffer for tokenizing/detokenizing */
+typedef struct {
+  uint8_t *data;
+  size_t len;
+  size_t cap;
+  bool failed;
+} ByteBuf;
+
+static void buf_put(ByteBuf *buf, const void *bytes, size_t n) {
+  if (buf->failed)
+    return;
+  if (buf->len + n > buf->cap) {
+    size_t cap = buf->cap ? buf->cap : 64;
+    while (cap < buf->len + n)
+      cap *= 2;
+    uint8_t *grown = safe_realloc(buf->data, buf->cap, cap);
+    if (!grown) {
+      buf->failed = true;
+      return;
+    }
+    buf->data = grown;
+    buf->cap = cap;
+  }
+  memcpy(buf->data + buf->len, bytes, n);
+  buf->len += n;
+}
+
+static void buf_byte(ByteBuf *buf, uint8_t b) { buf_put(buf, &b, 1); }
+
+static void buf_u32(ByteBuf *buf, uint32_t v) {
+  uint8_t b[4] = {(uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16),
+                  (uint8_t)(v >> 24)};
+  buf_put(buf, b, 4);
+}
+
+/* Shrink to the exact size so each line costs only what it encodes; NULL
+ * if memory ran out along the way */
+static uint8_t *buf_finish(ByteBuf *buf) {
+  if (buf->failed) {
+    safe_free(buf->data);
+    return NULL;
+  }
+  if (buf->cap > buf->len && buf->data) {
+    uint8_t *exact = safe_realloc(buf->data, buf->cap, buf->len);
+    if (exact)
+      buf->data = exact;
+  }
+  return buf->data;
+}
+
+uint8_t *lexer_tokenize(const char *text, size_t *length) {
+  Lexer lexer;
+  lexer_init(&lexer, text);
+  ByteBuf buf = {NULL, 0, 0, false};
+
+  while (true) {
+    Token token = lexer_next_token(&lexer);
+    if (token.type == TOK_EOF || token.type == TOK_NEWLINE) {
+      token_free(&token);
+      break;
+    }
+    if ((token.type == TOK_STRING || token.type == TOK_IDENTIFIER) &&
+        !token.text) {
+      buf.failed = true;
+      break;
+    }
+
+    if (token.type == TOK_NUMBER) {
+      buf_byte(&buf, CODE_NUMBER);
+      buf_put(&buf, &token.number_value, sizeof(token.number_value));
+    } else if (token.type == TOK_STRING) {
+      size_t len = strlen(token.text);
+      buf_byte(&buf, CODE_STRING);
+      buf_u32(&buf, (uint32_t)len);
+      buf_put(&buf, token.text, len);
+    } else if (token.type == TOK_IDENTIFIER) {
+      size_t len = strlen(token.text);
+      if (len > 0xFFFF)
+        len = 0xFFFF;
+      buf_byte(&buf, CODE_IDENT);
+      buf_byte(&buf, (uint8_t)len);
+      buf_byte(&buf, (uint8_t)(len >> 8));
+      buf_put(&buf, token.text, len);
+    } else if (token.type == TOK_ERROR) {
+      buf_byte(&buf, CODE_CHAR);
+      buf_byte(&buf, (uint8_t)lexer.input[lexer.position - 1]);
+    } else {
+      buf_byte(&buf, (uint8_t)(CODE_TOKEN + token.type));
+    }
+
+    if (token.type == TOK_DATA) {
+      /* Items run verbatim to an unquoted colon, as on the C64: they may
+       * be unquoted strings that don't tokenize */
+      const char *start = text + lexer.position;
+      const char *p = start;
+      bool quoted = false;
+      while (*p && *p != '\n' && (quoted || *p != ':')) {
+        if (*p == '"')
+          quoted = !quoted;
+        p++;
+      }
+      buf_byte(&buf, CODE_DATA);
+      buf_u32(&buf, (uint32_t)(p - start));
+      buf_put(&buf, start, (size_t)(p - start));
+      lexer.position += (int)(p - start);
+    }
+
+    if (token.type == TOK_REM) {
+      /* Keep the comment verbatim for LIST; it is never executed */
+      const char *rest = text + lexer.position;
+      size_t len = strlen(rest);
+      buf_byte(&buf, CODE_TEXT);
+      buf_u32(&buf, (uint32_t)len);
+      buf_put(&buf, rest, len);
+      token_free(&token);
+      break;
+    }
+    token_free(&token);
+  }
+
+  buf_byte(&buf, CODE_END);
+  *length = buf.len;
+  return buf_finish(&buf);
+}
+
+/* Fingerprint of the token numbering, so pre-tokenized images from a build
+ * with a different keyword set are rejected instead of misread */
+uint32_t lexer_code_version(void) {
+  uint64_t hash = FNV_OFFSET_BASIS;
+  for (int i = 0; keywords[i].keyword != NULL; i++) {
+    hash = hash_fnv1a(keywords[i].keyword, strlen(keywords[i].keyword), hash);
+    hash = hash_fnv1a(&keywords[i].type, sizeof(keywords[i].type), hash);
+  }
+  TokenType last = TOK_ERROR;
+  hash = hash_fnv1a(&last, sizeof(last), hash);
+  return (uint32_t)(hash ^ (hash >> 32));
+}
+
+bool lexer_code_valid(const uint8_t *code, size_t len) {
+  size_t pos = 0;
+  while (pos < len && code[pos] != CODE_END) {
+    size_t left = len - pos - 1;
+    size_t size;
+    switch (code[pos]) {
+    case CODE_NUMBER:
+      size = sizeof(double);
+      break;
+    case CODE_STRING:
+    case CODE_TEXT:
+    case CODE_DATA:
+      if (left < 4)
+        return false;
+      size = 4 + (size_t)read_u32(code + pos + 1);
+      break;
+    case CODE_IDENT:
+      if (left < 2)
+        return false;
+      size = 2 + (size_t)(code[pos + 1] | (code[pos + 2] << 8));
+      if (size == 2)
+        return false; // Names are never empty
+      break;
+    case CODE_CHAR:
+      size = 1;
+      break;
+    default:
+      /* Literals have their own tags; EOF and friends are never stored */
+      if (code[pos] <= CODE_TOKEN + TOK_IDENTIFIER ||
+          code[pos] >= CODE_TOKEN + TOK_NEWLINE)
+        return false;
+      size = 0;
+      break;
+    }
+    if (size > left)
+      return false;
+    pos += 1 + size;
+  }
+  return pos == len - 1;
+}
+
+const char *lexer_code_data(const uint8_t *code, size_t *pos, size_t *len) {
+  const uint8_t *p = code + *pos;
+  while (*p != CODE_END) {
+    switch (*p) {
+    case CODE_NUMBER:
+      p += 1 + sizeof(double);
+      break;
+    case CODE_STRING:
+    case CODE_TEXT:
+      p += 5 + read_u32(p + 1);
+      break;
+    case CODE_IDENT:
+      p += 3 + (p[1] | (p[2] << 8));
+      break;
+    case CODE_CHAR:
+      p += 2;
+      break;
+    case CODE_DATA:
+      *len = read_u32(p + 1);
+      *pos = (size_t)(p - code) + 5 + *len;
+      return (const char *)p + 5;
+    default:
+      p++;
+      break;
+    }
+  }
+  *pos = (size_t)(p - code);
+  return NULL;
+}
+
+void lexer_code_retype(uint8_t *code, size_t pos, TokenType type) {
+  code[pos] = (uint8_t)(CODE_TOKEN + type);
+}
+
+static const char *token_source_text(TokenType type) {
+  for (int i = 0; keywords[i].keyword != NULL; i++) {
+    if (keywords[i].type == type)
+      return keywords[i].keyword;
+  }
+  switch (type) {
+  case TOK_PLUS:
+  case TOK_CONCAT:
+    return "+";
+  case TOK_MINUS:
+    return "-";
+  case TOK_MULTIPLY:
+    return "*";
+  case TOK_DIVIDE:
+    return "/";
+  case TOK_POWER:
+    return "^";
+  case TOK_EQUAL:
+  case TOK_STR_EQUAL:
+    return "=";
+  case TOK_NOT_EQUAL:
+  case TOK_STR_NOT_EQUAL:
+    return "<>";
+  case TOK_LESS:
+  case TOK_STR_LESS:
+    return "<";
+  case TOK_GREATER:
+  case TOK_STR_GREATER:
+    return ">";
+  case TOK_LESS_EQUAL:
+  case TOK_STR_LESS_EQUAL:
+    return "<=";
+  case TOK_GREATER_EQUAL:
+  case TOK_STR_GREATER_EQUAL:
+    return ">=";
+  case TOK_LPAREN:
+    return "(";
+  case TOK_RPAREN:
+    return ")";
+  case TOK_COMMA:
+    return ",";
+  case TOK_SEMICOLON:
+    return ";";
+  case TOK_COLON:
+    return ":";
+  case TOK_QUESTION:
+    return "?";
+  case TOK_HASH:
+    return "#";
+  case TOK_LBRACE:
+    return "{";
+  case TOK_RBRACE:
+    return "}";
+  default:
+    return "";
+  }
+}
+
+/* Rebuild source text from a pre-tokenized line, LIST-style: tokens are
+ * separated by single spaces except around delimiters */
+char *lexer_detokenize(const uint8_t *code) {
+  ByteBuf buf = {NULL, 0, 0, false};
+  const uint8_t *p = code;
+  bool space = false; /* a separator is due before the next token */
+
+  while (*p != CODE_END) {
+    uint8_t b = *p;
+    bool joins_left = b == CODE_TOKEN + TOK_COMMA ||
+                      b == CODE_TOKEN + TOK_SEMICOLON ||
+                      b == CODE_TOKEN + TOK_RPAREN ||
+                      b == CODE_TOKEN + TOK_LPAREN ||
+                      b == CODE_TOKEN + TOK_HASH ||
+                      b == CODE_TOKEN + TOK_LBRACE ||
+                      b == CODE_TOKEN + TOK_RBRACE || b == CODE_TEXT ||
+                      b == CODE_DATA;
+    if (space && !joins_left)
+      buf_byte(&buf, ' ');
+    space = true;
+
+    if (b == CODE_NUMBER) {
+      double value;
+      memcpy(&value, p + 1, sizeof(value));
+      char num[NUMBER_BUF_SIZE];
+      int len = format_number(num, value);
+      /* Literals are never negative; drop the sign column */
+      buf_put(&buf, num + 1, (size_t)len - 1);
+      p += 1 + sizeof(value);
+    } else if (b == CODE_STRING) {
+      uint32_t len = read_u32(p + 1);
+      buf_byte(&buf, '"');
+      buf_put(&buf, p + 5, len);
+      buf_byte(&buf, '"');
+      p += 5 + len;
+    } else if (b == CODE_IDENT) {
+      size_t len = p[1] | (p[2] << 8);
+      buf_put(&buf, p + 3, len);
+      p += 3 + len;
+    } else if (b == CODE_CHAR) {
+      buf_byte(&buf, p[1]);
+      p += 2;
+    } else if (b == CODE_TEXT || b == CODE_DATA) {
+      uint32_t len = read_u32(p + 1);
+      buf_put(&buf, p + 5, len);
+      p += 5 + len;
+    } else {
+      const char *text = token_source_text((TokenType)(b - CODE_TOKEN));
+      buf_put(&buf, text, strlen(text));
+      p++;
+      if (b == CODE_TOKEN + TOK_LPAREN || b == CODE_TOKEN + TOK_HASH ||
+          b == CODE_TOKEN + TOK_LBRACE)
+        space = false;
+    }
+  }
+
+  buf_byte(&buf, '\0');
+  return (char *)buf_finish(&buf);
+}
+
 const char *token_type_name(TokenType type) {
   switch (type) {
   case TOK_NUMBER:
@@ -1,6 +1,10 @@
 #ifndef LEXER_H
 #define LEXER_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 /* Token types */
 typedef enum {
   /* Literals */
@@ -51,6 +55,18 @@ typedef enum {
   TOK_POKE,
   TOK_PLOT,
   TOK_DRAW,
+  TOK_BOX,
+  TOK_CIRCLE,
+  TOK_PAINT,
+  TOK_OPEN,
+  TOK_CLOSE,
+  TOK_GET,
+  TOK_BLOAD,
+  TOK_BSAVE,
+  TOK_SNAPSHOT,
+  TOK_MAT,
+  TOK_SORT,
+  TOK_DELETE,
 
   /* Operators */
   TOK_PLUS,
@@ -67,6 +83,15 @@ typedef enum {
   TOK_AND,
   TOK_OR,
   TOK_NOT,
+  /* String forms of + and the relations, in the same order; the compile
+   * pass writes them where both operands are strings */
+  TOK_CONCAT,
+  TOK_STR_EQUAL,
+  TOK_STR_NOT_EQUAL,
+  TOK_STR_LESS,
+  TOK_STR_GREATER,
+  TOK_STR_LESS_EQUAL,
+  TOK_STR_GREATER_EQUAL,
 
   /* Built-in functions */
   TOK_ABS,
@@ -85,6 +110,9 @@ typedef enum {
   TOK_CHR,
   TOK_ASC,
   TOK_PEEK,
+  TOK_SEARCH,
+  TOK_EXISTS,
+  TOK_KEY,
 
   /* Delimiters */
   TOK_LPAREN,
@@ -93,6 +121,9 @@ typedef enum {
   TOK_SEMICOLON,
   TOK_COLON,
   TOK_QUESTION, /* ? is shorthand for PRINT */
+  TOK_HASH,     /* # in PRINT#, INPUT#, GET# */
+  TOK_LBRACE,   /* { } around a map key */
+  TOK_RBRACE,
 
   /* Special */
   TOK_NEWLINE,
@@ -110,6 +141,7 @@ typedef struct {
 
 typedef struct {
   const char *input;
+  const uint8_t *code; /* Pre-tokenized line; replaces input when set */
   int position;
   int line;
   int column;
@@ -118,10 +150,33 @@ typedef struct {
 
 /* Lexer functions */
 void lexer_init(Lexer *lexer, const char *input);
+void lexer_init_code(Lexer *lexer, const uint8_t *code);
 void lexer_free(Lexer *lexer);
 Token lexer_next_token(Lexer *lexer);
 Token lexer_peek_token(Lexer *lexer);
+/* Type of the next token, without decoding it (or copying its text) when
+ * the line is pre-tokenized */
+TokenType lexer_peek_type(Lexer *lexer);
 void token_free(Token *token);
 const char *token_type_name(TokenType type);
 
+/* Pre-tokenized line format: one byte per keyword, operator or delimiter
+ * (0x80 + TokenType), numbers stored as already-converted doubles, and
+ * strings/identifiers length-prefixed. Terminated by a 0 byte. */
+uint8_t *lexer_tokenize(const char *text, size_t *length);
+uint32_t lexer_code_version(void);
+char *lexer_detokenize(const uint8_t *code);
+
+/* True if the `len` bytes at `code` are one well-formed line: every
+ * length stays inside them, every token byte is known, and the only 0 tag
+ * is the last byte. Checked before trusting code read from a file. */
+bool lexer_code_valid(const uint8_t *code, size_t len);
+
+/* Next DATA statement's item text in a pre-tokenized line at or after
+ * *pos; advances *pos past it. NULL when the line has no more. */
+const char *lexer_code_data(const uint8_t *code, size_t *pos, size_t *len);
+
+/* Replace the one-byte token at code[pos] with another of that kind */
+void lexer_code_retype(uint8_t *code, size_t pos, TokenType type);
+
 #endif /* LEXER_H */
@@ -0,0 +1,184 @@
+#include "matrix.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MAT_X86 1
+#include <immintrin.h>
+#endif
+
+typedef struct {
+  const char *name;
+  void (*add)(double *dst, const double *a, const double *b, size_t n);
+  void (*sub)(double *dst, const double *a, const double *b, size_t n);
+  void (*scale)(double *dst, const double *a, double k, size_t n);
+  void (*axpy)(double *dst, const double *a, double k, size_t n); // dst+=k*a
+} MatKernels;
+
+static void add_c(double *dst, const double *a, const double *b, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    dst[i] = a[i] + b[i];
+}
+
+static void sub_c(double *dst, const double *a, const double *b, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    dst[i] = a[i] - b[i];
+}
+
+static void scale_c(double *dst, const double *a, double k, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    dst[i] = a[i] * k;
+}
+
+static void axpy_c(double *dst, const double *a, double k, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    dst[i] += a[i] * k;
+}
+
+static const MatKernels kernels_c = {"C", add_c, sub_c, scale_c, axpy_c};
+
+#ifdef MAT_X86
+/* Unaligned loads and stores throughout: arrays come from safe_malloc and
+ * only have malloc alignment. Multiply and add stay separate (no FMA) so
+ * every kernel set rounds exactly like the C one. */
+__attribute__((target("sse2"))) static void
+add_sse2(double *dst, const double *a, const double *b, size_t n) {
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2)
+    _mm_storeu_pd(dst + i,
+                  _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+  add_c(dst + i, a + i, b + i, n - i);
+}
+
+__attribute__((target("sse2"))) static void
+sub_sse2(double *dst, const double *a, const double *b, size_t n) {
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2)
+    _mm_storeu_pd(dst + i,
+                  _mm_sub_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+  sub_c(dst + i, a + i, b + i, n - i);
+}
+
+__attribute__((target("sse2"))) static void
+scale_sse2(double *dst, const double *a, double k, size_t n) {
+  __m128d kv = _mm_set1_pd(k);
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2)
+    _mm_storeu_pd(dst + i, _mm_mul_pd(_mm_loadu_pd(a + i), kv));
+  scale_c(dst + i, a + i, k, n - i);
+}
+
+__attribute__((target("sse2"))) static void
+axpy_sse2(double *dst, const double *a, double k, size_t n) {
+  __m128d kv = _mm_set1_pd(k);
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2)
+    _mm_storeu_pd(dst + i, _mm_add_pd(_mm_loadu_pd(dst + i),
+                                      _mm_mul_pd(_mm_loadu_pd(a + i), kv)));
+  axpy_c(dst + i, a + i, k, n - i);
+}
+
+static const MatKernels kernels_sse2 = {"SSE2", add_sse2, sub_sse2,
+                                        scale_sse2, axpy_sse2};
+
+__attribute__((target("avx2"))) static void
+add_avx2(double *dst, const double *a, const double *b, size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    _mm256_storeu_pd(dst + i, _mm256_add_pd(_mm256_loadu_pd(a + i),
+                                            _mm256_loadu_pd(b + i)));
+  add_c(dst + i, a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2"))) static void
+sub_avx2(double *dst, const double *a, const double *b, size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    _mm256_storeu_pd(dst + i, _mm256_sub_pd(_mm256_loadu_pd(a + i),
+                                            _mm256_loadu_pd(b + i)));
+  sub_c(dst + i, a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2"))) static void
+scale_avx2(double *dst, const double *a, double k, size_t n) {
+  __m256d kv = _mm256_set1_pd(k);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    _mm256_storeu_pd(dst + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), kv));
+  scale_c(dst + i, a + i, k, n - i);
+}
+
+__attribute__((target("avx2"))) static void
+axpy_avx2(double *dst, const double *a, double k, size_t n) {
+  __m256d kv = _mm256_set1_pd(k);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    _mm256_storeu_pd(dst + i,
+                     _mm256_add_pd(_mm256_loadu_pd(dst + i),
+                                   _mm256_mul_pd(_mm256_loadu_pd(a + i), kv)));
+  axpy_c(dst + i, a + i, k, n - i);
+}
+
+static const MatKernels kernels_avx2 = {"AVX2", add_avx2, sub_avx2,
+                                        scale_avx2, axpy_avx2};
+#endif
+
+static const MatKernels *kernels(void) {
+  static const MatKernels *chosen;
+  if (!chosen) {
+    chosen = &kernels_c;
+#ifdef MAT_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+      chosen = &kernels_avx2;
+    else if (__builtin_cpu_supports("sse2"))
+      chosen = &kernels_sse2;
+#endif
+  }
+  return chosen;
+}
+
+void mat_add(double *dst, const double *a, const double *b, size_t n) {
+  kernels()->add(dst, a, b, n);
+}
+
+void mat_sub(double *dst, const double *a, const double *b, size_t n) {
+  kernels()->sub(dst, a, b, n);
+}
+
+void mat_scale(double *dst, const double *a, double k, size_t n) {
+  kernels()->scale(dst, a, k, n);
+}
+
+void mat_fill(double *dst, double value, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    dst[i] = value;
+}
+
+/* Row by row as a sum of scaled rows of b (i-k-j order), so the inner
+ * loop is a unit-stride axpy over contiguous memory */
+void mat_multiply(double *dst, const double *a, const double *b, size_t rows,
+                  size_t inner, size_t cols) {
+  void (*axpy)(double *, const double *, double, size_t) = kernels()->axpy;
+  for (size_t i = 0; i < rows; i++) {
+    double *row = dst + i * cols;
+    mat_fill(row, 0, cols);
+    for (size_t k = 0; k < inner; k++)
+      axpy(row, b + k * cols, a[i * inner + k], cols);
+  }
+}
+
+/* In square tiles so both sides stay in cache for large matrices */
+#define TRANSPOSE_TILE 32
+
+void mat_transpose(double *dst, const double *a, size_t rows, size_t cols) {
+  for (size_t r0 = 0; r0 < rows; r0 += TRANSPOSE_TILE) {
+    size_t r1 = r0 + TRANSPOSE_TILE < rows ? r0 + TRANSPOSE_TILE : rows;
+    for (size_t c0 = 0; c0 < cols; c0 += TRANSPOSE_TILE) {
+      size_t c1 = c0 + TRANSPOSE_TILE < cols ? c0 + TRANSPOSE_TILE : cols;
+      for (size_t r = r0; r < r1; r++)
+        for (size_t c = c0; c < c1; c++)
+          dst[c * rows + r] = a[r * cols + c];
+    }
+  }
+}
+
+const char *mat_kernel_name(void) { return kernels()->name; }
@@ -0,0 +1,26 @@
+#ifndef MATRIX_H
+#define MATRIX_H
+
+#include <stddef.h>
+
+/* Kernels behind MAT, over contiguous row-major blocks of doubles. The
+ * element-wise ones use AVX2 or SSE2 when the CPU has them (checked once,
+ * at first use) and plain C otherwise; all paths give identical results.
+ * Element-wise destinations may alias their sources. */
+void mat_add(double *dst, const double *a, const double *b, size_t n);
+void mat_sub(double *dst, const double *a, const double *b, size_t n);
+void mat_scale(double *dst, const double *a, double k, size_t n);
+void mat_fill(double *dst, double value, size_t n);
+
+/* dst (rows x cols) = a (rows x inner) * b (inner x cols). dst must not
+ * overlap a or b. */
+void mat_multiply(double *dst, const double *a, const double *b, size_t rows,
+                  size_t inner, size_t cols);
+
+/* dst (cols x rows) = transpose of a (rows x cols); no overlap allowed */
+void mat_transpose(double *dst, const double *a, size_t rows, size_t cols);
+
+/* Name of the kernel set in use: "AVX2", "SSE2" or "C" */
+const char *mat_kernel_name(void);
+
+#endif /* MATRIX_H */
@@ -0,0 +1,183 @@
+#include "memmap.h"
+#include "editor.h"
+#include "utils.h"
+#include <string.h>
+
+/* C64 I/O layout */
+#define SCREEN_RAM 0x0400 // 1024-2023, 40x25 screen codes
+#define SCREEN_SIZE 1000
+#define VIC_BASE 0xD000 // 64 registers, mirrored through $D3FF
+#define SID_BASE 0xD400 // 32 registers, mirrored through $D7FF
+#define COLOR_RAM 0xD800 // 1000 nybbles, 4 bits wide
+#define CIA1_BASE 0xDC00 // 16 registers, mirrored through $DCFF
+#define CIA2_BASE 0xDD00 // 16 registers, mirrored through $DDFF
+
+void mem_map(Interpreter *interp, int first_page, int last_page,
+             MemReadFn read, MemWriteFn write) {
+  for (int page = first_page; page <= last_page; page++) {
+    interp->pages[page].read = read;
+    interp->pages[page].write = write;
+  }
+}
+
+/* Bytes from addr to the end of its run of pages that share plain RAM (or
+ * I/O) handling in the given direction, capped at len */
+static size_t mem_run(Interpreter *interp, size_t addr, size_t len,
+                      bool write) {
+  bool plain = write ? !interp->pages[addr >> 8].write
+                     : !interp->pages[addr >> 8].read;
+  size_t end = addr + len;
+  size_t next = (addr | 0xFF) + 1;
+  while (next < end) {
+    bool p = write ? !interp->pages[next >> 8].write
+                   : !interp->pages[next >> 8].read;
+    if (p != plain)
+      break;
+    next += 256;
+  }
+  return (next < end ? next : end) - addr;
+}
+
+void mem_write_block(Interpreter *interp, uint16_t addr, const uint8_t *src,
+                     size_t len) {
+  size_t pos = addr;
+  while (len) {
+    size_t run = mem_run(interp, pos, len, true);
+    if (!interp->pages[pos >> 8].write) {
+      memcpy(interp->ram + pos, src, run);
+    } else {
+      for (size_t i = 0; i < run; i++)
+        mem_poke(interp, (uint16_t)(pos + i), src[i]);
+    }
+    pos += run;
+    src += run;
+    len -= run;
+  }
+}
+
+void mem_read_block(Interpreter *interp, uint16_t addr, uint8_t *dst,
+                    size_t len) {
+  size_t pos = addr;
+  while (len) {
+    size_t run = mem_run(interp, pos, len, false);
+    if (!interp->pages[pos >> 8].read) {
+      memcpy(dst, interp->ram + pos, run);
+    } else {
+      for (size_t i = 0; i < run; i++)
+        dst[i] = mem_peek(interp, (uint16_t)(pos + i));
+    }
+    pos += run;
+    dst += run;
+    len -= run;
+  }
+}
+
+bool mem_map_image(Interpreter *interp, const char *filename) {
+  uint8_t *image = file_map_shared(filename, RAM_SIZE);
+  if (!image)
+    return false;
+  mem_unmap_image(interp);
+  interp->ram = image;
+  interp->ram_mapped = true;
+  return true;
+}
+
+void mem_unmap_image(Interpreter *interp) {
+  if (!interp->ram_mapped)
+    return;
+  file_unmap_shared(interp->ram, RAM_SIZE);
+  interp->ram = interp->ram_store;
+  interp->ram_mapped = false;
+}
+
+/* Screen RAM: ram[] holds what was POKEd and stays authoritative while the
+ * terminal still shows it. Only cells PRINT has written over are decoded
+ * from the editor, so PEEK sees text that never went through POKE. */
+static uint8_t screen_read(Interpreter *interp, uint16_t addr) {
+  uint8_t val = interp->ram[addr];
+  if (interp->editor && addr < SCREEN_RAM + SCREEN_SIZE &&
+      !editor_shows_char(interp->editor, addr, val))
+    return editor_peek_char(interp->editor, addr);
+  return val;
+}
+
+/* Writes go into the editor's cell buffer at once, so reads never depend
+ * on whether a frame has been drawn; mem_sync_screen() sends them later */
+static void screen_write(Interpreter *interp, uint16_t addr, uint8_t val) {
+  interp->ram[addr] = val;
+  if (interp->editor && addr < SCREEN_RAM + SCREEN_SIZE) {
+    editor_poke_char(interp->editor, addr, val);
+    interp->screen_pending = true;
+  }
+}
+
+void mem_sync_screen(Interpreter *interp) {
+  if (!interp->screen_pending)
+    return;
+  interp->screen_pending = false;
+  if (interp->editor)
+    editor_flush(interp->editor);
+}
+
+void mem_discard_screen(Interpreter *interp) { interp->screen_pending = false; }
+
+/* Color RAM is only 4 bits wide; the upper nybble reads back as 1s */
+static uint8_t color_read(Interpreter *interp, uint16_t addr) {
+  return (uint8_t)(0xF0 | (interp->ram[addr] & 0x0F));
+}
+
+static void color_write(Interpreter *interp, uint16_t addr, uint8_t val) {
+  interp->ram[addr] = val & 0x0F;
+}
+
+/* VIC-II: registers repeat every 64 bytes */
+static uint8_t vic_read(Interpreter *interp, uint16_t addr) {
+  return interp->ram[VIC_BASE + (addr & 0x3F)];
+}
+
+static void vic_write(Interpreter *interp, uint16_t addr, uint8_t val) {
+  int reg = addr & 0x3F;
+  interp->ram[VIC_BASE + reg] = val;
+  if (interp->editor && (reg == 0x20 || reg == 0x21)) {
+    // Border and background both map to the terminal background
+    editor_set_background_color(interp->editor, val);
+  }
+}
+
+/* SID: write-only except the paddle/oscillator 3/envelope 3 readbacks */
+static uint8_t sid_read(Interpreter *interp, uint16_t addr) {
+  int reg = addr & 0x1F;
+  if (reg >= 0x19 && reg <= 0x1C)
+    return interp->ram[SID_BASE + reg];
+  return 0;
+}
+
+static void sid_write(Interpreter *interp, uint16_t addr, uint8_t val) {
+  interp->ram[SID_BASE + (addr & 0x1F)] = val;
+}
+
+/* CIA stubs: registers repeat every 16 bytes. The keyboard/joystick
+ * ports of CIA 1 read as idle (all lines high). */
+static uint8_t cia_read(Interpreter *interp, uint16_t addr) {
+  uint16_t base = addr & 0xFF00;
+  int reg = addr & 0x0F;
+  if (base == CIA1_BASE && reg <= 1)
+    return 0xFF;
+  return interp->ram[base + reg];
+}
+
+static void cia_write(Interpreter *interp, uint16_t addr, uint8_t val) {
+  interp->ram[(addr & 0xFF00) + (addr & 0x0F)] = val;
+}
+
+void mem_init(Interpreter *interp) {
+  mem_discard_screen(interp);
+  mem_map(interp, 0x00, 0xFF, NULL, NULL);
+  mem_map(interp, SCREEN_RAM >> 8, (SCREEN_RAM + SCREEN_SIZE - 1) >> 8,
+          screen_read, screen_write);
+  mem_map(interp, VIC_BASE >> 8, (SID_BASE >> 8) - 1, vic_read, vic_write);
+  mem_map(interp, SID_BASE >> 8, (COLOR_RAM >> 8) - 1, sid_read, sid_write);
+  mem_map(interp, COLOR_RAM >> 8, (COLOR_RAM + SCREEN_SIZE - 1) >> 8,
+          color_read, color_write);
+  mem_map(interp, CIA1_BASE >> 8, CIA2_BASE >> 8, cia_read, cia_write);
+}
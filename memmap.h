@@ -0,0 +1,49 @@
+#ifndef MEMMAP_H
+#define MEMMAP_H
+
+#include "interpreter.h"
+
+/* Install the default C64 memory map: screen RAM, color RAM, VIC-II, SID
+ * and CIA pages get handlers; everything else is plain RAM. */
+void mem_init(Interpreter *interp);
+
+/* Route pages first..last (inclusive) through the given handlers. Passing
+ * NULL for a handler makes that direction plain RAM again. */
+void mem_map(Interpreter *interp, int first_page, int last_page,
+             MemReadFn read, MemWriteFn write);
+
+/* Send screen RAM cells written since the last sync to the terminal in
+ * one batched pass. Called at frame boundaries, not per POKE. */
+void mem_sync_screen(Interpreter *interp);
+
+/* Forget pending screen RAM updates (the screen was cleared) */
+void mem_discard_screen(Interpreter *interp);
+
+/* Copy len bytes in or out of memory starting at addr. Runs of plain RAM
+ * pages are one memcpy; I/O pages go through their handlers byte by byte.
+ * The caller keeps addr + len within RAM_SIZE. */
+void mem_write_block(Interpreter *interp, uint16_t addr, const uint8_t *src,
+                     size_t len);
+void mem_read_block(Interpreter *interp, uint16_t addr, uint8_t *dst,
+                    size_t len);
+
+/* Back ram with a 64KB image file mapped shared: its contents become
+ * memory and every store goes straight to the file. */
+bool mem_map_image(Interpreter *interp, const char *filename);
+void mem_unmap_image(Interpreter *interp);
+
+/* PEEK/POKE: plain RAM pages cost a single table test and array access */
+static inline uint8_t mem_peek(Interpreter *interp, uint16_t addr) {
+  MemReadFn read = interp->pages[addr >> 8].read;
+  return read ? read(interp, addr) : interp->ram[addr];
+}
+
+static inline void mem_poke(Interpreter *interp, uint16_t addr, uint8_t val) {
+  MemWriteFn write = interp->pages[addr >> 8].write;
+  if (write)
+    write(interp, addr, val);
+  else
+    interp->ram[addr] = val;
+}
+
+#endif /* MEMMAP_H */
@@ -0,0 +1,328 @@
+#include "numfmt.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Shortest round-trip double to decimal conversion (Grisu2, after Florian
+ * Loitsch, "Printing Floating-Point Numbers Quickly and Accurately with
+ * Integers"). Digits are produced with 64-bit integer arithmetic only and
+ * written straight into the caller's buffer -- no allocation, no printf.
+ * Grisu2 is not always shortest: about one value in ten thousand gets a
+ * digit or two too many, always with 16 or more digits. Those results
+ * are re-checked with printf (see shorten).
+ */
+
+typedef struct {
+  uint64_t f;
+  int e;
+} DiyFp;
+
+#define DP_SIGNIFICAND_SIZE 52
+#define DP_EXPONENT_BIAS (0x3FF + DP_SIGNIFICAND_SIZE)
+#define DP_MIN_EXPONENT (-DP_EXPONENT_BIAS)
+#define DP_EXPONENT_MASK 0x7FF0000000000000ULL
+#define DP_SIGNIFICAND_MASK 0x000FFFFFFFFFFFFFULL
+#define DP_HIDDEN_BIT 0x0010000000000000ULL
+
+/* Normalized 10^k for k = -348, -340, ..., 340 */
+static const uint64_t cached_powers_f[] = {
+    0xfa8fd5a0081c0288, 0xbaaee17fa23ebf76, 0x8b16fb203055ac76,
+    0xcf42894a5dce35ea, 0x9a6bb0aa55653b2d, 0xe61acf033d1a45df,
+    0xab70fe17c79ac6ca, 0xff77b1fcbebcdc4f, 0xbe5691ef416bd60c,
+    0x8dd01fad907ffc3c, 0xd3515c2831559a83, 0x9d71ac8fada6c9b5,
+    0xea9c227723ee8bcb, 0xaecc49914078536d, 0x823c12795db6ce57,
+    0xc21094364dfb5637, 0x9096ea6f3848984f, 0xd77485cb25823ac7,
+    0xa086cfcd97bf97f4, 0xef340a98172aace5, 0xb23867fb2a35b28e,
+    0x84c8d4dfd2c63f3b, 0xc5dd44271ad3cdba, 0x936b9fcebb25c996,
+    0xdbac6c247d62a584, 0xa3ab66580d5fdaf6, 0xf3e2f893dec3f126,
+    0xb5b5ada8aaff80b8, 0x87625f056c7c4a8b, 0xc9bcff6034c13053,
+    0x964e858c91ba2655, 0xdff9772470297ebd, 0xa6dfbd9fb8e5b88f,
+    0xf8a95fcf88747d94, 0xb94470938fa89bcf, 0x8a08f0f8bf0f156b,
+    0xcdb02555653131b6, 0x993fe2c6d07b7fac, 0xe45c10c42a2b3b06,
+    0xaa242499697392d3, 0xfd87b5f28300ca0e, 0xbce5086492111aeb,
+    0x8cbccc096f5088cc, 0xd1b71758e219652c, 0x9c40000000000000,
+    0xe8d4a51000000000, 0xad78ebc5ac620000, 0x813f3978f8940984,
+    0xc097ce7bc90715b3, 0x8f7e32ce7bea5c70, 0xd5d238a4abe98068,
+    0x9f4f2726179a2245, 0xed63a231d4c4fb27, 0xb0de65388cc8ada8,
+    0x83c7088e1aab65db, 0xc45d1df942711d9a, 0x924d692ca61be758,
+    0xda01ee641a708dea, 0xa26da3999aef774a, 0xf209787bb47d6b85,
+    0xb454e4a179dd1877, 0x865b86925b9bc5c2, 0xc83553c5c8965d3d,
+    0x952ab45cfa97a0b3, 0xde469fbd99a05fe3, 0xa59bc234db398c25,
+    0xf6c69a72a3989f5c, 0xb7dcbf5354e9bece, 0x88fcf317f22241e2,
+    0xcc20ce9bd35c78a5, 0x98165af37b2153df, 0xe2a0b5dc971f303a,
+    0xa8d9d1535ce3b396, 0xfb9b7cd9a4a7443c, 0xbb764c4ca7a44410,
+    0x8bab8eefb6409c1a, 0xd01fef10a657842c, 0x9b10a4e5e9913129,
+    0xe7109bfba19c0c9d, 0xac2820d9623bf429, 0x80444b5e7aa7cf85,
+    0xbf21e44003acdd2d, 0x8e679c2f5e44ff8f, 0xd433179d9c8cb841,
+    0x9e19db92b4e31ba9, 0xeb96bf6ebadf77d9, 0xaf87023b9bf0ee6b};
+
+static const int16_t cached_powers_e[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+    -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+    -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+    -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+    -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+    109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+    641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+    907, 933, 960, 986, 1013, 1039, 1066};
+
+static const uint64_t pow10_u64[] = {1ULL,
+                                     10ULL,
+                                     100ULL,
+                                     1000ULL,
+                                     10000ULL,
+                                     100000ULL,
+                                     1000000ULL,
+                                     10000000ULL,
+                                     100000000ULL,
+                                     1000000000ULL,
+                                     10000000000ULL,
+                                     100000000000ULL,
+                                     1000000000000ULL,
+                                     10000000000000ULL,
+                                     100000000000000ULL,
+                                     1000000000000000ULL,
+                                     10000000000000000ULL,
+                                     100000000000000000ULL,
+                                     1000000000000000000ULL,
+                                     10000000000000000000ULL};
+
+static DiyFp diy_make(uint64_t f, int e) {
+  DiyFp r;
+  r.f = f;
+  r.e = e;
+  return r;
+}
+
+static DiyFp diy_from_double(double d) {
+  uint64_t u;
+  memcpy(&u, &d, sizeof(u));
+  int biased_e = (int)((u & DP_EXPONENT_MASK) >> DP_SIGNIFICAND_SIZE);
+  uint64_t significand = u & DP_SIGNIFICAND_MASK;
+  if (biased_e != 0)
+    return diy_make(significand + DP_HIDDEN_BIT, biased_e - DP_EXPONENT_BIAS);
+  return diy_make(significand, DP_MIN_EXPONENT + 1);
+}
+
+static DiyFp diy_mul(DiyFp a, DiyFp b) {
+  const uint64_t m32 = 0xFFFFFFFFULL;
+  uint64_t ah = a.f >> 32, al = a.f & m32;
+  uint64_t bh = b.f >> 32, bl = b.f & m32;
+  uint64_t hh = ah * bh, lh = al * bh, hl = ah * bl, ll = al * bl;
+  uint64_t mid = (ll >> 32) + (hl & m32) + (lh & m32);
+  mid += 1ULL << 31; /* round */
+  return diy_make(hh + (hl >> 32) + (lh >> 32) + (mid >> 32), a.e + b.e + 64);
+}
+
+static DiyFp diy_normalize(DiyFp a) {
+  while (!(a.f & (1ULL << 63))) {
+    a.f <<= 1;
+    a.e--;
+  }
+  return a;
+}
+
+static void normalized_boundaries(DiyFp v, DiyFp *minus, DiyFp *plus) {
+  DiyFp pl = diy_make((v.f << 1) + 1, v.e - 1);
+  while (!(pl.f & (DP_HIDDEN_BIT << 1))) {
+    pl.f <<= 1;
+    pl.e--;
+  }
+  pl.f <<= 64 - DP_SIGNIFICAND_SIZE - 2;
+  pl.e -= 64 - DP_SIGNIFICAND_SIZE - 2;
+
+  DiyFp mi = (v.f == DP_HIDDEN_BIT) ? diy_make((v.f << 2) - 1, v.e - 2)
+                                    : diy_make((v.f << 1) - 1, v.e - 1);
+  mi.f <<= mi.e - pl.e;
+  mi.e = pl.e;
+
+  *plus = pl;
+  *minus = mi;
+}
+
+static DiyFp cached_power(int e, int *k) {
+  /* Pick 10^-k so the scaled exponent lands in [-60, -32] */
+  double dk = (-61 - e) * 0.30102999566398114 + 347;
+  int ik = (int)dk;
+  if (dk - ik > 0.0)
+    ik++;
+  unsigned index = (unsigned)((ik >> 3) + 1);
+  *k = -(-348 + (int)(index << 3));
+  return diy_make(cached_powers_f[index], cached_powers_e[index]);
+}
+
+static int count_digits(uint32_t n) {
+  int d = 1;
+  while (d < 10 && n >= pow10_u64[d])
+    d++;
+  return d;
+}
+
+static void grisu_round(char *buf, int len, uint64_t delta, uint64_t rest,
+                        uint64_t ten_kappa, uint64_t wp_w) {
+  while (rest < wp_w && delta - rest >= ten_kappa &&
+         (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+    buf[len - 1]--;
+    rest += ten_kappa;
+  }
+}
+
+static void digit_gen(DiyFp w, DiyFp mp, uint64_t delta, char *buf, int *len,
+                      int *k) {
+  DiyFp one = diy_make(1ULL << -mp.e, mp.e);
+  uint64_t wp_w = mp.f - w.f;
+  uint32_t p1 = (uint32_t)(mp.f >> -one.e);
+  uint64_t p2 = mp.f & (one.f - 1);
+  int kappa = count_digits(p1);
+  *len = 0;
+
+  while (kappa > 0) {
+    uint32_t d = p1 / (uint32_t)pow10_u64[kappa - 1];
+    p1 %= (uint32_t)pow10_u64[kappa - 1];
+    if (d || *len)
+      buf[(*len)++] = (char)('0' + d);
+    kappa--;
+    uint64_t rest = ((uint64_t)p1 << -one.e) + p2;
+    if (rest <= delta) {
+      *k += kappa;
+      grisu_round(buf, *len, delta, rest, pow10_u64[kappa] << -one.e,
+                  wp_w);
+      return;
+    }
+  }
+
+  for (;;) {
+    p2 *= 10;
+    delta *= 10;
+    char d = (char)(p2 >> -one.e);
+    if (d || *len)
+      buf[(*len)++] = (char)('0' + d);
+    p2 &= one.f - 1;
+    kappa--;
+    if (p2 < delta) {
+      *k += kappa;
+      int index = -kappa;
+      grisu_round(buf, *len, delta, p2, one.f,
+                  wp_w * (index < 20 ? pow10_u64[index] : 0));
+      return;
+    }
+  }
+}
+
+/* Shortest digits of a positive finite `value`: value = digits * 10^k */
+static int grisu2(double value, char *digits, int *k) {
+  DiyFp v = diy_from_double(value);
+  DiyFp w_m, w_p;
+  normalized_boundaries(v, &w_m, &w_p);
+
+  DiyFp c_mk = cached_power(w_p.e, k);
+  DiyFp w = diy_mul(diy_normalize(v), c_mk);
+  DiyFp wp = diy_mul(w_p, c_mk);
+  DiyFp wm = diy_mul(w_m, c_mk);
+  wm.f++;
+  wp.f--;
+
+  int len;
+  digit_gen(w, wp, wp.f - wm.f, digits, &len, k);
+  return len;
+}
+
+/* Grisu2 results of 16 or 17 digits may not be the shortest: find the
+ * fewest significant digits that still read back as `value` */
+static int shorten(double value, char *digits, int len, int *k) {
+  char text[32];
+  for (int precision = 15; precision < len; precision++) {
+    snprintf(text, sizeof(text), "%.*e", precision - 1, value);
+    if (strtod(text, NULL) != value)
+      continue;
+    char *e = strchr(text, 'e');
+    int n = 0;
+    for (char *p = text; p < e; p++)
+      if (*p >= '0' && *p <= '9')
+        digits[n++] = *p;
+    while (n > 1 && digits[n - 1] == '0')
+      n--;
+    *k = atoi(e + 1) - n + 1;
+    return n;
+  }
+  return len;
+}
+
+int format_number(char *buf, double value) {
+  char *p = buf;
+
+  if (isnan(value)) {
+    memcpy(buf, " NAN", 5);
+    return 4;
+  }
+  if (signbit(value) && value != 0) {
+    *p++ = '-';
+    value = -value;
+  } else {
+    *p++ = ' ';
+  }
+  if (isinf(value)) {
+    memcpy(p, "INF", 4);
+    return (int)(p - buf) + 3;
+  }
+  if (value == 0) {
+    *p++ = '0';
+    *p = '\0';
+    return (int)(p - buf);
+  }
+
+  char digits[20];
+  int k;
+  int len = grisu2(value, digits, &k);
+  if (len >= 16)
+    len = shorten(value, digits, len, &k);
+  int exp10 = len + k - 1; /* exponent of the leading digit */
+
+  if (exp10 >= 9 || exp10 < -2) {
+    /* d.dddE+XX */
+    *p++ = digits[0];
+    if (len > 1) {
+      *p++ = '.';
+      memcpy(p, digits + 1, (size_t)(len - 1));
+      p += len - 1;
+    }
+    *p++ = 'E';
+    int e = exp10;
+    if (e < 0) {
+      *p++ = '-';
+      e = -e;
+    } else {
+      *p++ = '+';
+    }
+    if (e >= 100)
+      *p++ = (char)('0' + e / 100);
+    *p++ = (char)('0' + (e / 10) % 10);
+    *p++ = (char)('0' + e % 10);
+  } else if (exp10 < 0) {
+    /* .00ddd -- CBM omits the leading zero */
+    *p++ = '.';
+    for (int i = exp10 + 1; i < 0; i++)
+      *p++ = '0';
+    memcpy(p, digits, (size_t)len);
+    p += len;
+  } else if (len <= exp10 + 1) {
+    /* Integer: digits followed by zero padding */
+    memcpy(p, digits, (size_t)len);
+    p += len;
+    for (int i = len; i <= exp10; i++)
+      *p++ = '0';
+  } else {
+    memcpy(p, digits, (size_t)(exp10 + 1));
+    p += exp10 + 1;
+    *p++ = '.';
+    memcpy(p, digits + exp10 + 1, (size_t)(len - exp10 - 1));
+    p += len - exp10 - 1;
+  }
+
+  *p = '\0';
+  return (int)(p - buf);
+}
@@ -0,0 +1,13 @@
+#ifndef NUMFMT_H
+#define NUMFMT_H
+
+/* Longest output of format_number(), including the terminating NUL */
+#define NUMBER_BUF_SIZE 32
+
+/* Write `value` as Commodore BASIC prints it: a leading space for
+ * non-negative values, the shortest digit string that reads back as the
+ * same double, and E notation outside .01 <= |x| < 1E+09.
+ * Returns the number of characters written, excluding the NUL. */
+int format_number(char *buf, double value);
+
+#endif /* NUMFMT_H */
@@ -0,0 +1,19 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+/* xoshiro256** generator behind RND. Each interpreter owns one, so
+ * streams are independent and need no locking. */
+typedef struct {
+  uint64_t s[4];
+} Rng;
+
+/* Set the state from a 64-bit seed, expanded with splitmix64 (which
+ * never yields the all-zero state); equal seeds give equal streams */
+void rng_seed(Rng *rng, uint64_t seed);
+uint64_t rng_next(Rng *rng);
+/* Uniform in [0, 1), from the top 53 bits of the next output */
+double rng_double(Rng *rng);
+
+#endif /* RNG_H */
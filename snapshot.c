@@ -0,0 +1,470 @@
+#include "snapshot.h"
+#include "utils.h"
+#include <stdio.h>
+#include <string.h>
+
+/* Snapshot file: a header, then these sections in order. Numbers are
+ * native doubles, guarded by the header's check value as in program
+ * images; other fields are little-endian u32, strings are u32 length +
+ * bytes, and lists are a u32 count followed by their entries.
+ *   program image (u32 size + interpreter_write_binary output)
+ *   resume line, resume offset
+ *   graphics x, graphics y, bitmap bits
+ *   RAM: a bit per 256-byte page that holds anything but zeros, then
+ *   those pages in order
+ *   DATA read position + 1, or 0 while the pool is unbuilt
+ *   RND state: four u64, each as low then high u32
+ *   variables: u8 type, name, then a double, a string, a u32 integer,
+ *   for arrays u32 dimension count, u32 extents and the elements in
+ *   row-major order, or for maps a list of keys, each followed by its
+ *   value
+ *   GOSUB stack (innermost first): return line
+ *   FOR stack (innermost first): name, end, step, line */
+#define SNAPSHOT_MAGIC "CFS\x1a"
+#define SNAPSHOT_VERSION 5
+#define SNAPSHOT_HEADER_SIZE (4 + 1 + sizeof(double))
+#define SNAPSHOT_CHECK 1.0
+
+static void write_u32(FILE *file, uint32_t v) {
+  uint8_t bytes[4];
+  put_u32(bytes, v);
+  fwrite(bytes, 1, sizeof(bytes), file);
+}
+
+static void write_double(FILE *file, double v) {
+  fwrite(&v, sizeof(v), 1, file);
+}
+
+static void write_string(FILE *file, const char *s) {
+  size_t len = s ? strlen(s) : 0;
+  write_u32(file, (uint32_t)len);
+  if (len)
+    fwrite(s, 1, len, file);
+}
+
+#define RAM_PAGES (RAM_SIZE / 256)
+
+static bool page_is_zero(const uint8_t *page) {
+  for (int i = 0; i < 256; i++)
+    if (page[i])
+      return false;
+  return true;
+}
+
+static void write_ram(Interpreter *interp, FILE *file) {
+  uint8_t used[RAM_PAGES / 8] = {0};
+  for (int page = 0; page < RAM_PAGES; page++)
+    if (!page_is_zero(interp->ram + page * 256))
+      used[page >> 3] |= (uint8_t)(1 << (page & 7));
+  fwrite(used, 1, sizeof(used), file);
+  for (int page = 0; page < RAM_PAGES; page++)
+    if (used[page >> 3] & (1 << (page & 7)))
+      fwrite(interp->ram + page * 256, 1, 256, file);
+}
+
+static void write_array(FILE *file, Variable *var) {
+  write_u32(file, (uint32_t)var->value.array.dim_count);
+  for (int i = 0; i < var->value.array.dim_count; i++)
+    write_u32(file, (uint32_t)var->value.array.dimensions[i]);
+  if (var->type == VAR_ARRAY_NUMBER) {
+    fwrite(var->value.array.data, sizeof(double), var->value.array.count,
+           file);
+  } else if (var->type == VAR_ARRAY_INTEGER) {
+    int32_t *integers = var->value.array.data;
+    for (size_t i = 0; i < var->value.array.count; i++)
+      write_u32(file, (uint32_t)integers[i]);
+  } else {
+    char **strings = var->value.array.data;
+    for (size_t i = 0; i < var->value.array.count; i++)
+      write_string(file, strings[i]);
+  }
+}
+
+static void write_map(FILE *file, Variable *var) {
+  HashMap *map = &var->value.map;
+  write_u32(file, (uint32_t)map->count);
+  for (size_t i = 0; i < map->count; i++) {
+    write_string(file, map->entries[i].key);
+    if (map->strings)
+      write_string(file, map->entries[i].value.string);
+    else
+      write_double(file, map->entries[i].value.number);
+  }
+}
+
+static bool write_state(Interpreter *interp, FILE *file, int line_number,
+                        size_t offset) {
+  uint8_t header[SNAPSHOT_HEADER_SIZE];
+  double check = SNAPSHOT_CHECK;
+  memcpy(header, SNAPSHOT_MAGIC, 4);
+  header[4] = SNAPSHOT_VERSION;
+  memcpy(header + 5, &check, sizeof(check));
+  fwrite(header, 1, sizeof(header), file);
+
+  /* The image size is patched in once the image is written */
+  long size_at = ftell(file);
+  write_u32(file, 0);
+  if (size_at < 0 || !interpreter_write_binary(interp, file))
+    return false;
+  long end = ftell(file);
+  if (end < 0 || fseek(file, size_at, SEEK_SET) != 0)
+    return false;
+  write_u32(file, (uint32_t)(end - size_at - 4));
+  if (fseek(file, end, SEEK_SET) != 0)
+    return false;
+
+  write_u32(file, (uint32_t)line_number);
+  write_u32(file, (uint32_t)offset);
+  write_double(file, interp->graphics_x);
+  write_double(file, interp->graphics_y);
+  fwrite(interp->bitmap.bits, 1, sizeof(interp->bitmap.bits), file);
+  write_ram(interp, file);
+  write_u32(file, interp->data.built ? (uint32_t)interp->data.next + 1 : 0);
+  for (int i = 0; i < 4; i++) {
+    write_u32(file, (uint32_t)interp->rng.s[i]);
+    write_u32(file, (uint32_t)(interp->rng.s[i] >> 32));
+  }
+
+  uint32_t count = 0;
+  for (Variable *var = interp->variables; var; var = var->next)
+    count++;
+  write_u32(file, count);
+  for (Variable *var = interp->variables; var; var = var->next) {
+    fputc(var->type, file);
+    write_string(file, var->name);
+    if (var->type == VAR_NUMBER)
+      write_double(file, var->value.number);
+    else if (var->type == VAR_STRING)
+      write_string(file, var->value.string);
+    else if (var->type == VAR_INTEGER)
+      write_u32(file, (uint32_t)var->value.integer);
+    else if (var->type == VAR_MAP_NUMBER || var->type == VAR_MAP_STRING)
+      write_map(file, var);
+    else
+      write_array(file, var);
+  }
+
+  count = 0;
+  for (StackFrame *frame = interp->call_stack; frame; frame = frame->next)
+    count++;
+  write_u32(file, count);
+  for (StackFrame *frame = interp->call_stack; frame; frame = frame->next)
+    write_u32(file, (uint32_t)frame->return_line);
+
+  count = 0;
+  for (ForLoop *loop = interp->for_stack; loop; loop = loop->next)
+    count++;
+  write_u32(file, count);
+  for (ForLoop *loop = interp->for_stack; loop; loop = loop->next) {
+    write_string(file, loop->var_name);
+    write_double(file, loop->end_value);
+    write_double(file, loop->step_value);
+    write_u32(file, (uint32_t)loop->loop_line);
+  }
+  return !ferror(file);
+}
+
+bool snapshot_save(Interpreter *interp, const char *filename, int line_number,
+                   size_t offset) {
+  FILE *file = fopen(filename, "wb");
+  if (!file)
+    return false;
+  bool ok = write_state(interp, file, line_number, offset);
+  return fclose(file) == 0 && ok;
+}
+
+/* Bounds-checked cursor over a mapped snapshot; any overrun sets failed
+ * and makes every later read return nothing */
+typedef struct {
+  const uint8_t *pos;
+  const uint8_t *end;
+  bool failed;
+} Reader;
+
+static const uint8_t *take(Reader *r, size_t len) {
+  if (r->failed || (size_t)(r->end - r->pos) < len) {
+    r->failed = true;
+    return NULL;
+  }
+  const uint8_t *data = r->pos;
+  r->pos += len;
+  return data;
+}
+
+static uint32_t read_u32(Reader *r) {
+  const uint8_t *data = take(r, 4);
+  return data ? get_u32(data) : 0;
+}
+
+static double read_double(Reader *r) {
+  double v = 0;
+  const uint8_t *data = take(r, sizeof(v));
+  if (data)
+    memcpy(&v, data, sizeof(v));
+  return v;
+}
+
+/* Owned copy of a string field */
+static char *read_string(Reader *r) {
+  uint32_t len = read_u32(r);
+  const uint8_t *data = take(r, len);
+  if (!data)
+    return NULL;
+  char *s = safe_malloc((size_t)len + 1);
+  if (!s) {
+    r->failed = true;
+    return NULL;
+  }
+  memcpy(s, data, len);
+  s[len] = '\0';
+  return s;
+}
+
+/* Read an array's shape and elements; it is created at the list head */
+static Variable *read_array(Interpreter *interp, Reader *r, const char *name,
+                            uint8_t type) {
+  uint32_t dim_count = read_u32(r);
+  int dims[ARRAY_MAX_DIMS];
+  if (r->failed || dim_count < 1 || dim_count > ARRAY_MAX_DIMS)
+    return NULL;
+  char suffix = name[strlen(name) - 1];
+  if (type != (suffix == '$'   ? VAR_ARRAY_STRING
+               : suffix == '%' ? VAR_ARRAY_INTEGER
+                               : VAR_ARRAY_NUMBER))
+    return NULL;
+
+  /* Every element takes at least 4 bytes of file: reject shapes the rest
+   * of the file cannot hold before allocating them */
+  size_t room = (size_t)(r->end - r->pos) / 4;
+  for (uint32_t i = 0; i < dim_count; i++) {
+    uint32_t extent = read_u32(r);
+    if (r->failed || extent < 1 || extent > room)
+      return NULL;
+    room /= extent;
+    dims[i] = (int)extent;
+  }
+
+  Variable *var = array_create(interp, name, dims, (int)dim_count);
+  if (!var)
+    return NULL;
+  size_t count = var->value.array.count;
+  if (type == VAR_ARRAY_NUMBER) {
+    const uint8_t *data =
+        count <= SIZE_MAX / sizeof(double) ? take(r, count * sizeof(double))
+                                           : NULL;
+    if (data)
+      memcpy(var->value.array.data, data, count * sizeof(double));
+  } else if (type == VAR_ARRAY_INTEGER) {
+    int32_t *integers = var->value.array.data;
+    for (size_t i = 0; i < count && !r->failed; i++)
+      integers[i] = (int32_t)read_u32(r);
+  } else {
+    char **strings = var->value.array.data;
+    for (size_t i = 0; i < count && !r->failed; i++) {
+      strings[i] = read_string(r);
+      if (strings[i] && !strings[i][0]) {
+        safe_free(strings[i]);
+        strings[i] = NULL;
+      }
+    }
+  }
+  return var;
+}
+
+/* Read a map's keys and values; it is created at the list head */
+static Variable *read_map(Interpreter *interp, Reader *r, const char *name,
+                          uint8_t type) {
+  bool is_string = name[strlen(name) - 1] == '$';
+  if (is_string != (type == VAR_MAP_STRING))
+    return NULL;
+  Variable *var = map_create(interp, name);
+  if (!var)
+    return NULL;
+  uint32_t count = read_u32(r);
+  for (uint32_t i = 0; i < count && !r->failed; i++) {
+    char *key = read_string(r);
+    MapEntry *entry = key ? map_insert(&var->value.map, key) : NULL;
+    safe_free(key);
+    if (!entry)
+      r->failed = true;
+    else if (is_string)
+      entry->value.string = read_string(r);
+    else
+      entry->value.number = read_double(r);
+  }
+  return var;
+}
+
+static void read_variables(Interpreter *interp, Reader *r) {
+  uint32_t count = read_u32(r);
+  Variable **tail = &interp->variables;
+  for (uint32_t i = 0; i < count && !r->failed; i++) {
+    const uint8_t *type = take(r, 1);
+    char *name = read_string(r);
+    if (name && name[0] && *type != VAR_NUMBER && *type != VAR_STRING &&
+        *type != VAR_INTEGER) {
+      Variable *var = NULL;
+      if (*type == VAR_ARRAY_NUMBER || *type == VAR_ARRAY_STRING ||
+          *type == VAR_ARRAY_INTEGER)
+        var = read_array(interp, r, name, *type);
+      else if (*type == VAR_MAP_NUMBER || *type == VAR_MAP_STRING)
+        var = read_map(interp, r, name, *type);
+      safe_free(name);
+      if (!var) {
+        r->failed = true;
+        return;
+      }
+      /* Move it from the head of the list to the tail */
+      interp->variables = var->next;
+      var->next = NULL;
+      *tail = var;
+      tail = &var->next;
+      continue;
+    }
+    Variable *var = name ? safe_malloc(sizeof(Variable)) : NULL;
+    if (!var) {
+      safe_free(name);
+      r->failed = true;
+      return;
+    }
+    var->name = name;
+    var->type = VAR_NUMBER;
+    var->value.number = 0;
+    var->next = NULL;
+    *tail = var;
+    tail = &var->next;
+
+    if (*type == VAR_NUMBER) {
+      var->value.number = read_double(r);
+    } else if (*type == VAR_STRING) {
+      var->type = VAR_STRING;
+      var->value.string = read_string(r);
+    } else if (*type == VAR_INTEGER) {
+      var->type = VAR_INTEGER;
+      var->value.integer = (int32_t)read_u32(r);
+    } else {
+      r->failed = true;
+    }
+  }
+}
+
+static void read_stacks(Interpreter *interp, Reader *r) {
+  uint32_t count = read_u32(r);
+  StackFrame **frame_tail = &interp->call_stack;
+  for (uint32_t i = 0; i < count && !r->failed; i++) {
+    uint32_t line = read_u32(r);
+    StackFrame *frame = r->failed ? NULL : safe_malloc(sizeof(StackFrame));
+    if (!frame) {
+      r->failed = true;
+      return;
+    }
+    frame->return_line = (int)line;
+    frame->next = NULL;
+    *frame_tail = frame;
+    frame_tail = &frame->next;
+  }
+
+  count = read_u32(r);
+  ForLoop **loop_tail = &interp->for_stack;
+  for (uint32_t i = 0; i < count && !r->failed; i++) {
+    char *name = read_string(r);
+    double end = read_double(r);
+    double step = read_double(r);
+    uint32_t line = read_u32(r);
+    ForLoop *loop = r->failed ? NULL : safe_malloc(sizeof(ForLoop));
+    if (!loop) {
+      safe_free(name);
+      r->failed = true;
+      return;
+    }
+    loop->var_name = name;
+    loop->end_value = end;
+    loop->step_value = step;
+    loop->loop_line = (int)line;
+    loop->next = NULL;
+    *loop_tail = loop;
+    loop_tail = &loop->next;
+  }
+}
+
+static bool read_state(Interpreter *interp, const uint8_t *src, size_t size,
+                       int *line_number, size_t *offset) {
+  double check;
+  if (size < SNAPSHOT_HEADER_SIZE || memcmp(src, SNAPSHOT_MAGIC, 4) != 0 ||
+      src[4] != SNAPSHOT_VERSION)
+    return false;
+  memcpy(&check, src + 5, sizeof(check));
+  if (check != SNAPSHOT_CHECK)
+    return false;
+
+  Reader r = {src + SNAPSHOT_HEADER_SIZE, src + size, false};
+  uint32_t image_size = read_u32(&r);
+  const uint8_t *image = take(&r, image_size);
+  if (!image || !interpreter_is_binary(image, image_size) ||
+      !interpreter_load_image(interp, image, image_size))
+    return false;
+  data_clear(&interp->data);
+
+  *line_number = (int)read_u32(&r);
+  *offset = read_u32(&r);
+  double x = read_double(&r);
+  double y = read_double(&r);
+  const uint8_t *bits = take(&r, sizeof(interp->bitmap.bits));
+  const uint8_t *used = take(&r, RAM_PAGES / 8);
+  int used_pages = 0;
+  for (int page = 0; used && page < RAM_PAGES; page++)
+    if (used[page >> 3] & (1 << (page & 7)))
+      used_pages++;
+  const uint8_t *pages = take(&r, (size_t)used_pages * 256);
+  uint32_t data_pos = read_u32(&r);
+  Rng rng;
+  for (int i = 0; i < 4; i++) {
+    rng.s[i] = read_u32(&r);
+    rng.s[i] |= (uint64_t)read_u32(&r) << 32;
+  }
+  if (r.failed || !(x >= -GFX_COORD_MAX && x <= GFX_COORD_MAX) ||
+      !(y >= -GFX_COORD_MAX && y <= GFX_COORD_MAX))
+    return false;
+
+  interp->graphics_x = x;
+  interp->graphics_y = y;
+  interp->rng = rng;
+  memcpy(interp->bitmap.bits, bits, sizeof(interp->bitmap.bits));
+  memset(interp->bitmap.dirty, 0xFF, sizeof(interp->bitmap.dirty));
+  interp->bitmap.any_dirty = true;
+  memset(interp->ram, 0, RAM_SIZE);
+  for (int page = 0; page < RAM_PAGES; page++) {
+    if (used[page >> 3] & (1 << (page & 7))) {
+      memcpy(interp->ram + page * 256, pages, 256);
+      pages += 256;
+    }
+  }
+
+  if (data_pos) {
+    if (!data_build(interp) || data_pos - 1 > (uint32_t)interp->data.count)
+      return false;
+    interp->data.next = (int)(data_pos - 1);
+  }
+
+  read_variables(interp, &r);
+  read_stacks(interp, &r);
+  return !r.failed && r.pos == r.end;
+}
+
+bool snapshot_restore(Interpreter *interp, const char *filename,
+                      int *line_number, size_t *offset) {
+  size_t size;
+  const uint8_t *src = file_map(filename, &size);
+  if (!src)
+    return false;
+
+  *line_number = SNAPSHOT_NO_LINE;
+  *offset = 0;
+  bool ok = read_state(interp, src, size, line_number, offset);
+  file_unmap(src, size);
+  if (!ok) {
+    interpreter_new(interp);
+    *line_number = SNAPSHOT_NO_LINE;
+  }
+  return ok;
+}
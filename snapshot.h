@@ -0,0 +1,22 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "interpreter.h"
+
+/* Marks a snapshot taken outside a running program */
+#define SNAPSHOT_NO_LINE (-1)
+
+/* Write the whole interpreter state to a file: program, variables, GOSUB
+ * and FOR stacks, RAM, bitmap, graphics cursor and READ position. A
+ * running program resumes at `offset` bytes into the code of line_number.
+ * Open files and the screen are not part of the state. */
+bool snapshot_save(Interpreter *interp, const char *filename, int line_number,
+                   size_t offset);
+
+/* Replace the interpreter state with a snapshot. *line_number is
+ * SNAPSHOT_NO_LINE unless a running program should be resumed with
+ * interpreter_resume(). On failure the interpreter is left empty. */
+bool snapshot_restore(Interpreter *interp, const char *filename,
+                      int *line_number, size_t *offset);
+
+#endif /* SNAPSHOT_H */
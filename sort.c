@@ -0,0 +1,285 @@
+#include "sort.h"
+#include "utils.h"
+#include <string.h>
+
+/* Numbers: each double maps to a u64 key whose unsigned order is numeric
+ * order (negatives have all bits flipped, positives the sign bit set), so
+ * the keys sort by digits and map back exactly. */
+#define RADIX_BITS 11
+#define RADIX_SIZE (1 << RADIX_BITS)
+#define RADIX_MASK (RADIX_SIZE - 1)
+#define RADIX_PASSES 6 // ceil(64 / RADIX_BITS)
+#define SIGN_BIT 0x8000000000000000ULL
+#define RADIX_COUNTS_SIZE (RADIX_PASSES * RADIX_SIZE * sizeof(uint32_t))
+
+static uint64_t number_key(double v) {
+  uint64_t bits;
+  memcpy(&bits, &v, sizeof(bits));
+  return bits & SIGN_BIT ? ~bits : bits | SIGN_BIT;
+}
+
+static double key_number(uint64_t key) {
+  uint64_t bits = key & SIGN_BIT ? key & ~SIGN_BIT : ~key;
+  double v;
+  memcpy(&v, &bits, sizeof(v));
+  return v;
+}
+
+/* Sort keys[0..n) (pos alongside, if set) using keys[n..2n) and
+ * pos[n..2n) as scratch, with the digit histograms right after keys[2n);
+ * returns where the sorted keys ended up */
+static uint64_t *radix_sort(uint64_t *keys, uint32_t *pos, size_t n,
+                            uint32_t **pos_out) {
+  /* One pass builds the histograms of every digit */
+  uint32_t(*counts)[RADIX_SIZE] = (uint32_t(*)[RADIX_SIZE])(keys + 2 * n);
+  memset(counts, 0, RADIX_COUNTS_SIZE);
+  for (size_t i = 0; i < n; i++) {
+    if (pos)
+      pos[i] = (uint32_t)i;
+    for (int p = 0; p < RADIX_PASSES; p++)
+      counts[p][(keys[i] >> (p * RADIX_BITS)) & RADIX_MASK]++;
+  }
+
+  uint64_t *src = keys, *dst = keys + n;
+  uint32_t *pos_src = pos, *pos_dst = pos ? pos + n : NULL;
+  for (int p = 0; p < RADIX_PASSES; p++) {
+    int shift = p * RADIX_BITS;
+    uint32_t *count = counts[p];
+    if (count[(src[0] >> shift) & RADIX_MASK] == n)
+      continue; // Every key has the same digit here
+    uint32_t total = 0;
+    for (int d = 0; d < RADIX_SIZE; d++) {
+      uint32_t c = count[d];
+      count[d] = total;
+      total += c;
+    }
+    for (size_t i = 0; i < n; i++) {
+      uint32_t j = count[(src[i] >> shift) & RADIX_MASK]++;
+      dst[j] = src[i];
+      if (pos)
+        pos_dst[j] = pos_src[i];
+    }
+    uint64_t *swap = src;
+    src = dst;
+    dst = swap;
+    uint32_t *pos_swap = pos_src;
+    pos_src = pos_dst;
+    pos_dst = pos_swap;
+  }
+  *pos_out = pos_src;
+  return src;
+}
+
+/* Key (plus histogram) and position blocks for radix_sort; false if
+ * memory ran out */
+static bool radix_alloc(size_t n, uint32_t *order, uint64_t **keys,
+                        uint32_t **pos) {
+  *keys = safe_malloc(2 * n * sizeof(uint64_t) + RADIX_COUNTS_SIZE);
+  *pos = order ? safe_malloc(2 * n * sizeof(uint32_t)) : NULL;
+  if (*keys && (!order || *pos))
+    return true;
+  safe_free(*keys);
+  safe_free(*pos);
+  return false;
+}
+
+/* Descending order sorts complemented keys, which keeps equal elements
+ * stable */
+bool sort_numbers(double *values, size_t n, bool descending,
+                  uint32_t *order) {
+  if (n < 2) {
+    if (order && n)
+      order[0] = 0;
+    return true;
+  }
+  uint64_t *keys;
+  uint32_t *pos, *sorted_pos;
+  if (!radix_alloc(n, order, &keys, &pos))
+    return false;
+  for (size_t i = 0; i < n; i++)
+    keys[i] = descending ? ~number_key(values[i]) : number_key(values[i]);
+
+  uint64_t *sorted = radix_sort(keys, pos, n, &sorted_pos);
+  for (size_t i = 0; i < n; i++)
+    values[i] = key_number(descending ? ~sorted[i] : sorted[i]);
+  if (order)
+    memcpy(order, sorted_pos, n * sizeof(uint32_t));
+  safe_free(keys);
+  safe_free(pos);
+  return true;
+}
+
+/* Integers: flipping the sign bit gives unsigned order in 32 bits, and
+ * the digits above them are all equal, so only three passes run */
+bool sort_integers(int32_t *values, size_t n, bool descending,
+                   uint32_t *order) {
+  if (n < 2) {
+    if (order && n)
+      order[0] = 0;
+    return true;
+  }
+  uint64_t *keys;
+  uint32_t *pos, *sorted_pos;
+  if (!radix_alloc(n, order, &keys, &pos))
+    return false;
+  for (size_t i = 0; i < n; i++) {
+    uint32_t key = (uint32_t)values[i] ^ 0x80000000u;
+    keys[i] = descending ? ~key : key;
+  }
+
+  uint64_t *sorted = radix_sort(keys, pos, n, &sorted_pos);
+  for (size_t i = 0; i < n; i++) {
+    uint32_t key = (uint32_t)(descending ? ~sorted[i] : sorted[i]);
+    values[i] = (int32_t)(key ^ 0x80000000u);
+  }
+  if (order)
+    memcpy(order, sorted_pos, n * sizeof(uint32_t));
+  safe_free(keys);
+  safe_free(pos);
+  return true;
+}
+
+/* Strings: the first 8 bytes, big-endian and zero padded, order the same
+ * way strcmp does, so most comparisons never leave the item array */
+typedef struct {
+  uint64_t prefix;
+  char *s;
+  uint32_t pos;
+} StrItem;
+
+#define MERGE_RUN 32 // Insertion-sorted before merging
+
+static uint64_t string_prefix(const char *s) {
+  uint64_t prefix = 0;
+  for (int i = 0; i < 8; i++) {
+    prefix <<= 8;
+    if (*s)
+      prefix |= (unsigned char)*s++;
+  }
+  return prefix;
+}
+
+static int item_compare(const StrItem *a, const StrItem *b, bool descending) {
+  int c;
+  if (a->prefix != b->prefix)
+    c = a->prefix < b->prefix ? -1 : 1;
+  else
+    c = strcmp(a->s ? a->s : "", b->s ? b->s : "");
+  return descending ? -c : c;
+}
+
+bool sort_strings(char **values, size_t n, bool descending, uint32_t *order) {
+  if (n < 2) {
+    if (order && n)
+      order[0] = 0;
+    return true;
+  }
+  StrItem *items = safe_malloc(2 * n * sizeof(StrItem));
+  if (!items)
+    return false;
+  for (size_t i = 0; i < n; i++) {
+    items[i].prefix = string_prefix(values[i] ? values[i] : "");
+    items[i].s = values[i];
+    items[i].pos = (uint32_t)i;
+  }
+
+  for (size_t start = 0; start < n; start += MERGE_RUN) {
+    size_t end = start + MERGE_RUN < n ? start + MERGE_RUN : n;
+    for (size_t i = start + 1; i < end; i++) {
+      StrItem item = items[i];
+      size_t j = i;
+      while (j > start && item_compare(&item, &items[j - 1], descending) < 0) {
+        items[j] = items[j - 1];
+        j--;
+      }
+      items[j] = item;
+    }
+  }
+
+  /* Bottom-up merges, alternating between the two halves of the block. The
+   * right element only goes first when strictly smaller: stable. */
+  StrItem *src = items, *dst = items + n;
+  for (size_t width = MERGE_RUN; width < n; width *= 2) {
+    for (size_t left = 0; left < n; left += 2 * width) {
+      size_t mid = left + width < n ? left + width : n;
+      size_t right = mid + width < n ? mid + width : n;
+      size_t i = left, j = mid, k = left;
+      while (i < mid && j < right)
+        dst[k++] = item_compare(&src[j], &src[i], descending) < 0 ? src[j++]
+                                                                  : src[i++];
+      while (i < mid)
+        dst[k++] = src[i++];
+      while (j < right)
+        dst[k++] = src[j++];
+    }
+    StrItem *swap = src;
+    src = dst;
+    dst = swap;
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    values[i] = src[i].s;
+    if (order)
+      order[i] = src[i].pos;
+  }
+  safe_free(items);
+  return true;
+}
+
+long search_numbers(const double *values, size_t n, double x, int direction) {
+  if (!direction) {
+    for (size_t i = 0; i < n; i++)
+      if (values[i] == x)
+        return (long)i;
+    return -1;
+  }
+  size_t lo = 0, hi = n;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (direction > 0 ? values[mid] < x : values[mid] > x)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo < n && values[lo] == x ? (long)lo : -1;
+}
+
+long search_integers(const int32_t *values, size_t n, int32_t x,
+                     int direction) {
+  if (!direction) {
+    for (size_t i = 0; i < n; i++)
+      if (values[i] == x)
+        return (long)i;
+    return -1;
+  }
+  size_t lo = 0, hi = n;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (direction > 0 ? values[mid] < x : values[mid] > x)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo < n && values[lo] == x ? (long)lo : -1;
+}
+
+long search_strings(char *const *values, size_t n, const char *x,
+                    int direction) {
+  if (!direction) {
+    for (size_t i = 0; i < n; i++)
+      if (strcmp(values[i] ? values[i] : "", x) == 0)
+        return (long)i;
+    return -1;
+  }
+  size_t lo = 0, hi = n;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    int c = strcmp(values[mid] ? values[mid] : "", x);
+    if (direction > 0 ? c < 0 : c > 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo < n && strcmp(values[lo] ? values[lo] : "", x) == 0 ? (long)lo
+                                                                : -1;
+}
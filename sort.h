@@ -0,0 +1,32 @@
+#ifndef SORT_H
+#define SORT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Stable in-place sorts behind SORT. When `order` is not NULL it receives
+ * the original position of each element in its new place. They return
+ * false, leaving the values untouched, if scratch memory runs out. */
+
+/* LSD radix sorts, 11 bits per pass, of doubles (by their IEEE bit
+ * patterns) and of integers */
+bool sort_numbers(double *values, size_t n, bool descending,
+                  uint32_t *order);
+bool sort_integers(int32_t *values, size_t n, bool descending,
+                   uint32_t *order);
+
+/* Merge sort of string pointers (NULL sorts as ""), comparing a cached
+ * 8-byte prefix before touching the strings themselves */
+bool sort_strings(char **values, size_t n, bool descending, uint32_t *order);
+
+/* Position of the first element equal to x, or -1. `direction` is 1 or -1
+ * when the values are known to be in ascending or descending order, which
+ * allows a binary search; 0 means scan them all. */
+long search_numbers(const double *values, size_t n, double x, int direction);
+long search_integers(const int32_t *values, size_t n, int32_t x,
+                     int direction);
+long search_strings(char *const *values, size_t n, const char *x,
+                    int direction);
+
+#endif /* SORT_H */
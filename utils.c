@@ -1,10 +1,20 @@
 #include "utils.h"
 #include <ctype.h>
+#include <errno.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 size_t total_memory_limit = 1073741824; /* 1GB default */
 size_t memory_used = 0;
 
@@ -128,39 +138,178 @@ void clear_screen(void) {
 #endif
 }
 
-char *read_line(const char *prompt) {
-  if (prompt) {
-    printf("%s", prompt);
-    fflush(stdout);
+int is_terminal(int fd) {
+#ifdef _WIN32
+  return _isatty(fd);
+#else
+  return isatty(fd);
+#endif
+}
+
+#ifndef _WIN32
+/* Buffers file_map() read from a stream instead of mapping; file_unmap()
+ * frees these and munmaps anything else */
+typedef struct StreamBuffer {
+  struct StreamBuffer *next;
+} StreamBuffer;
+
+static StreamBuffer *stream_buffers;
+
+/* Pipes, FIFOs and ttys have no size to map: read them to EOF */
+static const void *read_stream(int fd, size_t *size) {
+  static const char empty[1] = "";
+  size_t cap = 0, len = 0;
+  StreamBuffer *buf = NULL;
+  for (;;) {
+    if (len == cap) {
+      cap = cap ? cap * 2 : 65536;
+      StreamBuffer *grown = realloc(buf, sizeof(StreamBuffer) + cap);
+      if (!grown) {
+        free(buf);
+        return NULL;
+      }
+      buf = grown;
+    }
+    ssize_t n = read(fd, (char *)(buf + 1) + len, cap - len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      free(buf);
+      return NULL;
+    }
+    if (n == 0)
+      break;
+    len += (size_t)n;
+  }
+  if (len == 0) {
+    free(buf);
+    return empty;
   }
+  buf->next = stream_buffers;
+  stream_buffers = buf;
+  *size = len;
+  return buf + 1;
+}
+#endif
 
-  size_t capacity = 128;
-  size_t size = 0;
-  char *line = safe_malloc(capacity);
-  if (!line)
+/* Map a whole file read-only. Returns NULL if it cannot be opened; an empty
+ * file maps to a zero-length non-NULL buffer. Only regular files are
+ * mmap'd; anything else is read to EOF. Host I/O, not BASIC memory: not
+ * counted against -M. */
+const void *file_map(const char *filename, size_t *size) {
+  static const char empty[1] = "";
+  *size = 0;
+#ifdef _WIN32
+  FILE *file = fopen(filename, "rb");
+  if (!file)
     return NULL;
-
-  int c;
-  while ((c = fgetc(stdin)) != EOF && c != '\n') {
-    if (size + 1 >= capacity) {
-      capacity *= 2;
-      char *new_line = safe_realloc(line, capacity / 2, capacity);
-      if (!new_line) {
-        safe_free(line);
+  // Read to EOF rather than trusting ftell(), which fails on pipes
+  size_t cap = 0, len = 0;
+  char *data = NULL;
+  for (;;) {
+    if (len == cap) {
+      cap = cap ? cap * 2 : 65536;
+      char *grown = realloc(data, cap);
+      if (!grown) {
+        free(data);
+        fclose(file);
         return NULL;
       }
-      line = new_line;
+      data = grown;
+    }
+    size_t n = fread(data + len, 1, cap - len, file);
+    if (n == 0)
+      break;
+    len += n;
+  }
+  fclose(file);
+  if (len == 0) {
+    free(data);
+    return empty;
+  }
+  *size = len;
+  return data;
+#else
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return NULL;
+  }
+  if (!S_ISREG(st.st_mode)) {
+    const void *data = read_stream(fd, size);
+    close(fd);
+    return data;
+  }
+  if (st.st_size <= 0) {
+    close(fd);
+    return empty;
+  }
+  void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return NULL;
+  *size = (size_t)st.st_size;
+  return data;
+#endif
+}
+
+void file_unmap(const void *data, size_t size) {
+  if (!data || size == 0)
+    return;
+#ifdef _WIN32
+  free((void *)data);
+#else
+  for (StreamBuffer **p = &stream_buffers; *p; p = &(*p)->next) {
+    if ((const void *)(*p + 1) == data) {
+      StreamBuffer *buf = *p;
+      *p = buf->next;
+      free(buf);
+      return;
     }
-    line[size++] = (char)c;
   }
+  munmap((void *)data, size);
+#endif
+}
 
-  if (c == EOF && size == 0) {
-    safe_free(line);
+void *file_map_shared(const char *filename, size_t size) {
+#ifdef _WIN32
+  (void)filename;
+  (void)size;
+  return NULL;
+#else
+  int fd = open(filename, O_RDWR | O_CREAT, 0644);
+  if (fd < 0)
+    return NULL;
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      ((size_t)st.st_size < size && ftruncate(fd, (off_t)size) != 0)) {
+    close(fd);
     return NULL;
   }
+  void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  return data == MAP_FAILED ? NULL : data;
+#endif
+}
+
+void file_unmap_shared(void *data, size_t size) {
+#ifndef _WIN32
+  if (data)
+    munmap(data, size);
+#endif
+}
 
-  line[size] = '\0';
-  return line;
+uint64_t hash_fnv1a(const void *data, size_t size, uint64_t seed) {
+  const unsigned char *p = data;
+  uint64_t hash = seed;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= p[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
 }
 
 size_t parse_memory_size(const char *str) {
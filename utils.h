@@ -26,7 +26,30 @@ void warning(const char *format, ...);
 
 /* Platform-specific utilities */
 void clear_screen(void);
-char *read_line(const char *prompt);
+int is_terminal(int fd);
+const void *file_map(const char *filename, size_t *size);
+void file_unmap(const void *data, size_t size);
+/* Map exactly size bytes of a file read/write and shared, creating or
+ * growing it as needed, so stores land in the file. NULL on failure. */
+void *file_map_shared(const char *filename, size_t size);
+void file_unmap_shared(void *data, size_t size);
+
+/* Little-endian u32 fields of the binary file formats */
+static inline uint32_t get_u32(const uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+         ((uint32_t)p[3] << 24);
+}
+
+static inline void put_u32(uint8_t *p, uint32_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)(v >> 16);
+  p[3] = (uint8_t)(v >> 24);
+}
+
+/* 64-bit FNV-1a; pass FNV_OFFSET_BASIS or a previous result as seed */
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+uint64_t hash_fnv1a(const void *data, size_t size, uint64_t seed);
 
 /* Memory size parsing (for -M flag) */
 size_t parse_memory_size(const char *str);